@@ -23,10 +23,17 @@
 #include <ao/ao.h>
 
 #include "aoaudio.h"
+#include "pcm_convert.h"
 
 
 static ao_device *device;
 
+/* libao has no float sample format, so float samples are played as 16-bit */
+static int convert_float;
+
+/* number of float samples converted at once (the caller's buffer is left untouched) */
+#define CONVERT_BUF_SAMPLES 4096
+
 void ao_audio_close_device()
 {
     if (device) {
@@ -37,9 +44,37 @@ void ao_audio_close_device()
     }
 }
 
-int ao_audio_write(unsigned char *devbuf, int size)
+static int ao_audio_write_float(const unsigned char *devbuf, int size)
+{
+    unsigned char buf[CONVERT_BUF_SAMPLES * 2];
+
+    while (size >= 4) {
+        int num_samples = size / 4;
+        if (num_samples > CONVERT_BUF_SAMPLES) {
+            num_samples = CONVERT_BUF_SAMPLES;
+        }
+
+        pcm_convert_f32le_to_s16le(devbuf, buf, num_samples);
+
+        if (ao_play(device, (char *)buf, num_samples * 2) == 0) {
+            fprintf(stderr, "Error in ao_play()\n");
+            return -1;
+        }
+
+        devbuf += num_samples * 4;
+        size -= num_samples * 4;
+    }
+
+    return 0;
+}
+
+int ao_audio_write(const unsigned char *devbuf, int size)
 {
     if (device) {
+        if (convert_float) {
+            return ao_audio_write_float(devbuf, size);
+        }
+
         if (ao_play(device, (char *)devbuf, size) == 0) {
             fprintf(stderr, "Error in ao_play()\n");
             return -1;
@@ -59,7 +94,8 @@ int ao_audio_open_device(SampleInfo *sampleInfo)
 
     default_driver = ao_default_driver_id();
     memset(&format, 0, sizeof(format));
-    format.bits = sampleInfo->bitsPerSample;
+    convert_float = sampleInfo->isFloat;
+    format.bits = convert_float ? 16 : sampleInfo->bitsPerSample;
     format.channels = sampleInfo->channels;
     format.rate = sampleInfo->samplesPerSec;
     format.byte_format = AO_FMT_LITTLE;
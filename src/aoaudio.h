@@ -24,6 +24,6 @@
 
 void ao_audio_close_device();
 int ao_audio_open_device(SampleInfo *);
-int ao_audio_write(unsigned char *, int);
+int ao_audio_write(const unsigned char *, int);
 
 #endif /* AOAUDIO_H */
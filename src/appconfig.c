@@ -65,6 +65,12 @@ static int silence_percentage = 2;
 /* Draw moodbar in main window */
 static int show_moodbar = 1;
 
+/* Pad WAV headers so that track data can be cloned instead of copied */
+static int align_wav_data = 0;
+
+/* Keep samples decoded from compressed files in a temporary file */
+static int cache_decoded_audio = 0;
+
 /* function prototypes */
 static int appconfig_read_file();
 static void default_all_strings();
@@ -158,6 +164,26 @@ void appconfig_set_show_moodbar(int x)
     show_moodbar = x;
 }
 
+int appconfig_get_align_wav_data()
+{
+    return align_wav_data;
+}
+
+void appconfig_set_align_wav_data(int x)
+{
+    align_wav_data = x;
+}
+
+int appconfig_get_cache_decoded_audio()
+{
+    return cache_decoded_audio;
+}
+
+void appconfig_set_cache_decoded_audio(int x)
+{
+    cache_decoded_audio = x;
+}
+
 int appconfig_get_use_outputdir()
 {
     return use_outputdir;
@@ -276,6 +302,8 @@ struct ConfigOption_ {
 
     OPTION(silence_percentage, INTEGER),
     OPTION(show_moodbar, BOOLEAN),
+    OPTION(align_wav_data, BOOLEAN),
+    OPTION(cache_decoded_audio, BOOLEAN),
 #undef OPTION
     { NULL, INVALID, NULL, NULL },
 };
@@ -59,6 +59,10 @@ int appconfig_get_silence_percentage();
 void appconfig_set_silence_percentage(int x);
 int appconfig_get_show_moodbar();
 void appconfig_set_show_moodbar(int x);
+int appconfig_get_align_wav_data();
+void appconfig_set_align_wav_data(int x);
+int appconfig_get_cache_decoded_audio();
+void appconfig_set_cache_decoded_audio(int x);
 
 #endif /* APPCONFIG_H */
 
@@ -62,6 +62,9 @@ static GtkWidget *etree_cd_length_entry = NULL;
 
 static GtkWidget *silence_spin_button = NULL;
 
+static GtkWidget *align_wav_data_toggle = NULL;
+static GtkWidget *cache_decoded_audio_toggle = NULL;
+
 /* Forward declarations */
 static void open_select_outputdir();
 
@@ -127,6 +130,24 @@ static void prepend_file_number_toggled(GtkWidget *widget, gpointer user_data)
     }
 }
 
+static void align_wav_data_toggled(GtkWidget *widget, gpointer user_data)
+{
+    if (loading_ui) {
+        return;
+    }
+
+    appconfig_set_align_wav_data(gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(widget)) ? 1 : 0);
+}
+
+static void cache_decoded_audio_toggled(GtkWidget *widget, gpointer user_data)
+{
+    if (loading_ui) {
+        return;
+    }
+
+    appconfig_set_cache_decoded_audio(gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(widget)) ? 1 : 0);
+}
+
 static void appconfig_hide(GtkWidget *main_window)
 {
     gtk_widget_destroy(main_window);
@@ -242,6 +263,18 @@ void appconfig_show(GtkWidget *main_window)
     gtk_grid_attach(GTK_GRID(grid), silence_spin_button,
         1, 2, 1, 1);
 
+    align_wav_data_toggle = gtk_check_button_new_with_label(_("Align WAV track data for instant copies (Btrfs, XFS)"));
+    gtk_grid_attach(GTK_GRID(grid), align_wav_data_toggle,
+            0, 3, 2, 1);
+    g_signal_connect(G_OBJECT(align_wav_data_toggle), "toggled",
+        G_CALLBACK(align_wav_data_toggled), NULL);
+
+    cache_decoded_audio_toggle = gtk_check_button_new_with_label(_("Keep decoded MP3/Ogg/FLAC audio in a temporary file"));
+    gtk_grid_attach(GTK_GRID(grid), cache_decoded_audio_toggle,
+            0, 4, 2, 1);
+    g_signal_connect(G_OBJECT(cache_decoded_audio_toggle), "toggled",
+        G_CALLBACK(cache_decoded_audio_toggled), NULL);
+
     /* Etree Filename Suffix */
 
     grid = gtk_grid_new();
@@ -309,6 +342,12 @@ void appconfig_show(GtkWidget *main_window)
     gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(prepend_file_number_toggle),
             appconfig_get_prepend_file_number() ? TRUE : FALSE);
 
+    gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(align_wav_data_toggle),
+            appconfig_get_align_wav_data() ? TRUE : FALSE);
+
+    gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(cache_decoded_audio_toggle),
+            appconfig_get_cache_decoded_audio() ? TRUE : FALSE);
+
     gboolean use_etree = appconfig_get_use_etree_filename_suffix() ? TRUE : FALSE;
     gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(radio1), !use_etree);
     gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(radio2), use_etree);
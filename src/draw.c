@@ -182,6 +182,7 @@ draw_sample_surface(struct WaveformSurface *self, struct WaveformSurfaceDrawCont
     }
 
     if (self->surface != NULL && self->width == width && self->height == height && self->offset == ctx->pixmap_offset &&
+        self->zoom_level == ctx->zoom_level && self->analyzed_blocks == ctx->analyzed_blocks &&
         (ctx->moodbarData && ctx->moodbarData->numFrames) == self->moodbar) {
         return;
     }
@@ -220,23 +221,29 @@ draw_sample_surface(struct WaveformSurface *self, struct WaveformSurfaceDrawCont
     }
 
     /* draw sample graph */
+    unsigned long blocks_per_pixel = 1UL << ctx->zoom_level;
     int tb_index = 0;
     GList *tbl = ctx->list->breaks;
-    for (i = 0; i < width && i < ctx->graphData->numSamples; i++) {
-        y_min = ctx->graphData->data[i + ctx->pixmap_offset].min;
-        y_max = ctx->graphData->data[i + ctx->pixmap_offset].max;
+    for (i = 0; i < width; i++) {
+        unsigned long block = ctx->pixmap_offset + i * blocks_per_pixel;
+        if (block >= ctx->analyzed_blocks) {
+            /* the rest of the file is still being analyzed */
+            break;
+        }
+
+        Points peak = graph_data_get_range(ctx->graphData, block, MIN(block + blocks_per_pixel, ctx->analyzed_blocks));
 
-        y_min = xaxis + fabs((double)y_min) / scale;
-        y_max = xaxis - y_max / scale;
+        y_min = xaxis + fabs((double)peak.min) / scale;
+        y_max = xaxis - peak.max / scale;
 
         /* find the track break we are drawing now */
-        while (tbl->next && (i + ctx->pixmap_offset) > ((TrackBreak *)(tbl->next->data))->offset) {
+        while (tbl->next && block > ((TrackBreak *)(tbl->next->data))->offset) {
             tbl = tbl->next;
             ++tb_index;
         }
 
         if (ctx->moodbarData && ctx->moodbarData->numFrames) {
-            set_cairo_source(cr, moodbar_sample_color(ctx->moodbarData, (float)(i+ctx->pixmap_offset) / (float)ctx->graphData->numSamples));
+            set_cairo_source(cr, moodbar_sample_color(ctx->moodbarData, (float)block / (float)ctx->graphData->numSamples));
             draw_cairo_line(cr, i, 0.f, height);
             cairo_stroke(cr);
         }
@@ -261,6 +268,8 @@ draw_sample_surface(struct WaveformSurface *self, struct WaveformSurfaceDrawCont
     self->width = width;
     self->height = height;
     self->offset = ctx->pixmap_offset;
+    self->zoom_level = ctx->zoom_level;
+    self->analyzed_blocks = ctx->analyzed_blocks;
     self->moodbar = ctx->moodbarData && ctx->moodbarData->numFrames;
 }
 
@@ -270,14 +279,11 @@ draw_summary_surface(struct WaveformSurface *self, struct WaveformSurfaceDrawCon
     int xaxis;
     int width, height;
     int y_min, y_max;
-    int min, max;
     int scale;
-    int i, k;
-    int loop_end, array_offset;
+    int i;
+    unsigned long start, end;
     int shade;
 
-    float x_scale;
-
     GdkRGBA new_color;
 
     {
@@ -288,7 +294,7 @@ draw_summary_surface(struct WaveformSurface *self, struct WaveformSurfaceDrawCon
     }
 
     if (self->surface != NULL && self->width == width && self->height == height &&
-        (ctx->moodbarData && ctx->moodbarData->numFrames) == self->moodbar) {
+        self->analyzed_blocks == ctx->analyzed_blocks && (ctx->moodbarData && ctx->moodbarData->numFrames) == self->moodbar) {
         return;
     }
 
@@ -325,48 +331,32 @@ draw_summary_surface(struct WaveformSurface *self, struct WaveformSurfaceDrawCon
         scale = 1;
     }
 
-    /* draw sample graph */
-
-    x_scale = (float)(ctx->graphData->numSamples) / (float)(width);
-    if (x_scale == 0) {
-        x_scale = 1;
-    }
-
+    /* draw sample graph, each pixel covers the blocks [start, end) */
     int tb_index = 0;
     GList *tbl = ctx->list->breaks;
-    for (i = 0; i < width && i < ctx->graphData->numSamples; i++) {
-        min = max = 0;
-        array_offset = (int)(i * x_scale);
-
-        if (x_scale != 1) {
-            loop_end = (int)x_scale;
-
-            for (k = 0; k < loop_end; k++) {
-                if (ctx->graphData->data[array_offset + k].max > max) {
-                    max = ctx->graphData->data[array_offset + k].max;
-                } else if (ctx->graphData->data[array_offset + k].min < min) {
-                    min = ctx->graphData->data[array_offset + k].min;
-                }
-            }
-        } else {
-            min = ctx->graphData->data[i].min;
-            max = ctx->graphData->data[i].max;
+    for (i = 0; i < width; i++) {
+        start = (uint64_t)i * ctx->graphData->numSamples / width;
+        end = (uint64_t)(i + 1) * ctx->graphData->numSamples / width;
+        end = MIN(MAX(end, start + 1), ctx->analyzed_blocks);
+
+        if (start >= end) {
+            /* the rest of the file is still being analyzed */
+            break;
         }
 
-        y_min = min;
-        y_max = max;
+        Points peak = graph_data_get_range(ctx->graphData, start, end);
 
-        y_min = xaxis + fabs((double)y_min) / scale;
-        y_max = xaxis - y_max / scale;
+        y_min = xaxis + fabs((double)peak.min) / scale;
+        y_max = xaxis - peak.max / scale;
 
         /* find the track break we are drawing now */
-        while (tbl->next && array_offset > ((TrackBreak *)(tbl->next->data))->offset) {
+        while (tbl->next && start > ((TrackBreak *)(tbl->next->data))->offset) {
             tbl = tbl->next;
             ++tb_index;
         }
 
         if (ctx->moodbarData && ctx->moodbarData->numFrames) {
-            set_cairo_source(cr, moodbar_sample_color(ctx->moodbarData, (float)(array_offset) / (float)(ctx->graphData->numSamples)));
+            set_cairo_source(cr, moodbar_sample_color(ctx->moodbarData, (float)(start) / (float)(ctx->graphData->numSamples)));
             draw_cairo_line(cr, i, 0.f, height);
             cairo_stroke(cr);
         }
@@ -390,6 +380,7 @@ draw_summary_surface(struct WaveformSurface *self, struct WaveformSurfaceDrawCon
 
     self->width = width;
     self->height = height;
+    self->analyzed_blocks = ctx->analyzed_blocks;
     self->moodbar = ctx->moodbarData && ctx->moodbarData->numFrames;
 }
 
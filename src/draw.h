@@ -28,10 +28,14 @@ struct WaveformSurfaceDrawContext {
     GtkWidget *widget;
     // sample offset of sample view
     long pixmap_offset;
+    // sample view shows 2^zoom_level blocks per pixel
+    int zoom_level;
     // list of track breaks
     TrackBreakList *list;
     // sample information
     GraphData *graphData;
+    // number of blocks of graphData that have been analyzed so far
+    unsigned long analyzed_blocks;
     // moodbar information
     MoodbarData *moodbarData;
 };
@@ -41,6 +45,8 @@ struct WaveformSurface {
     unsigned long width;
     unsigned long height;
     unsigned long offset;
+    int zoom_level;
+    unsigned long analyzed_blocks;
     gboolean moodbar;
 
     void (*draw)(struct WaveformSurface *, struct WaveformSurfaceDrawContext *);
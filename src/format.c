@@ -22,12 +22,48 @@
 #include "format_cdda_raw.h"
 #include "format_mp3.h"
 #include "format_ogg_vorbis.h"
+#include "format_flac.h"
+#include "io_engine.h"
+#include "appconfig.h"
 
 #include <stdio.h>
+#include <string.h>
 #include <inttypes.h>
 #include <sys/stat.h>
 #include <errno.h>
 
+/* Size of the internal buffer of a FormatReader (if the file isn't mapped) */
+#define READER_BUF_SIZE (1024 * 1024)
+
+/* Number of sample frames decoded at once into the PCM cache */
+#define PCM_CACHE_REGION_FRAMES (64 * 1024)
+
+struct FormatReader_ {
+    OpenedAudioFile *file;
+
+    // position of the next byte returned from format_reader_next()
+    unsigned long position;
+
+    unsigned char *buf;
+    size_t buf_offset;
+    size_t buf_fill;
+    gboolean eof;
+
+    // private decoder instance, if the format module supports it
+    FormatDecoder *decoder;
+
+    // samples are served from the memory mapping of the file
+    gboolean mapped;
+
+    // read-ahead of the sample data, if the format module supports it (and mapping failed)
+    IoReadStream *stream;
+    const unsigned char *stream_data;
+    size_t stream_avail;
+
+    // byte order of the data in buf (only for big-endian format modules)
+    gboolean buf_big_endian;
+};
+
 void
 format_module_set_error_message(char **error_message, const char *fmt, ...)
 {
@@ -74,12 +110,56 @@ format_module_open_file(const FormatModule *self, OpenedAudioFile *file, const c
     file->fp = fp;
     file->file_size = st.st_size;
 
+    g_mutex_init(&file->info_mutex);
+
+    return TRUE;
+}
+
+gboolean
+format_module_map_file(OpenedAudioFile *file)
+{
+    GError *error = NULL;
+
+    file->mapped_file = g_mapped_file_new(file->filename, FALSE, &error);
+    if (file->mapped_file == NULL) {
+        g_debug("Could not map %s, using buffered reads: %s", file->filename, error->message);
+        g_error_free(error);
+        return FALSE;
+    }
+
     return TRUE;
 }
 
+const unsigned char *
+format_module_get_mapped_data(OpenedAudioFile *file, uint64_t offset, uint64_t length, size_t *buf_size)
+{
+    if (file->mapped_file == NULL) {
+        return NULL;
+    }
+
+    uint64_t mapped_length = g_mapped_file_get_length(file->mapped_file);
+    if (offset > mapped_length) {
+        return NULL;
+    }
+
+    if (length > mapped_length - offset) {
+        length = mapped_length - offset;
+    }
+
+    if (*buf_size > length) {
+        *buf_size = length;
+    }
+
+    return (const unsigned char *)g_mapped_file_get_contents(file->mapped_file) + offset;
+}
+
 void
 opened_audio_file_close(OpenedAudioFile *file)
 {
+    if (file->mapped_file) {
+        g_mapped_file_unref(g_steal_pointer(&file->mapped_file));
+    }
+
     if (file->details) {
         g_free(g_steal_pointer(&file->details));
     }
@@ -89,6 +169,37 @@ opened_audio_file_close(OpenedAudioFile *file)
     }
 
     g_free(g_steal_pointer(&file->filename));
+
+    if (file->pcm_cache) {
+        pcm_cache_free(g_steal_pointer(&file->pcm_cache));
+    }
+
+    g_mutex_clear(&file->info_mutex);
+}
+
+void
+format_module_set_info_estimated(OpenedAudioFile *file)
+{
+    g_mutex_lock(&file->info_mutex);
+    file->info_estimated = TRUE;
+    g_mutex_unlock(&file->info_mutex);
+}
+
+void
+format_module_set_exact_num_bytes(OpenedAudioFile *file, unsigned long num_bytes)
+{
+    g_mutex_lock(&file->info_mutex);
+    file->sample_info.numBytes = num_bytes;
+    file->info_estimated = FALSE;
+
+    format_info_changed_func callback = g_steal_pointer(&file->info_changed);
+    void *user_data = g_steal_pointer(&file->info_changed_user_data);
+
+    /* called with the lock held, so that format_close_file() can't return while it runs */
+    if (callback != NULL) {
+        callback(file, user_data);
+    }
+    g_mutex_unlock(&file->info_mutex);
 }
 
 static GList *
@@ -106,6 +217,7 @@ format_init(void)
         &format_module_cdda_raw,
         &format_module_mp3,
         &format_module_ogg_vorbis,
+        &format_module_flac,
     };
 
     if (!format_inited) {
@@ -137,30 +249,98 @@ format_print_supported(void)
     }
 }
 
+typedef struct {
+    const FormatModule *mod;
+    int score;
+} ProbeResult;
+
+static gint
+probe_result_compare(gconstpointer a, gconstpointer b, gpointer user_data)
+{
+    const ProbeResult *pa = a;
+    const ProbeResult *pb = b;
+
+    // highest score first (the sort is stable, so module order is kept for equal scores)
+    return pb->score - pa->score;
+}
+
 OpenedAudioFile *
 format_open_file(const char *filename, char **error_message)
 {
+    unsigned char head[FORMAT_PROBE_SIZE];
+    size_t head_size;
+
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) {
+        format_module_set_error_message(error_message, "Could not open file %s: %s", filename, strerror(errno));
+        return NULL;
+    }
+
+    head_size = fread(head, 1, sizeof(head), fp);
+    fclose(fp);
+
+    guint num_modules = g_list_length(g_modules);
+    ProbeResult *candidates = g_new0(ProbeResult, num_modules);
+    guint num_candidates = 0;
+
     GList *cur = g_list_first(g_modules);
     while (cur != NULL) {
         const FormatModule *mod = cur->data;
 
-        OpenedAudioFile *result = mod->open_file(mod, filename, error_message);
-        if (result != NULL) {
-            return result;
+        // modules without probe function are tried last
+        int score = 1;
+        if (mod->probe != NULL) {
+            score = mod->probe(mod, filename, head, head_size);
         }
 
-        if (error_message) {
-            g_debug("Open as %s failed: %s", mod->name, *error_message);
-            g_free(*error_message);
-            *error_message = NULL;
+        g_debug("Probe as %s: score %d", mod->name, score);
+
+        if (score > FORMAT_PROBE_SCORE_NONE) {
+            candidates[num_candidates].mod = mod;
+            candidates[num_candidates].score = score;
+            num_candidates++;
         }
 
         cur = g_list_next(cur);
     }
 
-    format_module_set_error_message(error_message, "File format unknown/not supported");
+    g_qsort_with_data(candidates, num_candidates, sizeof(ProbeResult), probe_result_compare, NULL);
+
+    OpenedAudioFile *result = NULL;
+    char *first_error_message = NULL;
+
+    for (guint i=0; i<num_candidates && result == NULL; ++i) {
+        const FormatModule *mod = candidates[i].mod;
+
+        result = mod->open_file(mod, filename, error_message);
+        if (result != NULL) {
+            result->pcm_converter = pcm_converter_get(&result->sample_info);
+            result->native_pcm_converter = mod->big_endian ?
+                pcm_converter_get_big_endian(&result->sample_info) : result->pcm_converter;
+        } else if (error_message) {
+            g_debug("Open as %s failed: %s", mod->name, *error_message);
+
+            // report the error of the best match
+            if (first_error_message == NULL) {
+                first_error_message = *error_message;
+            } else {
+                g_free(*error_message);
+            }
+            *error_message = NULL;
+        }
+    }
+
+    g_free(candidates);
 
-    return NULL;
+    if (result != NULL) {
+        g_free(first_error_message);
+    } else if (first_error_message != NULL) {
+        *error_message = first_error_message;
+    } else {
+        format_module_set_error_message(error_message, "File format unknown/not supported");
+    }
+
+    return result;
 }
 
 static char *
@@ -174,7 +354,12 @@ do_format_duration(uint64_t duration)
 void
 format_print_file_info(OpenedAudioFile *file)
 {
-    SampleInfo *si = &file->sample_info;
+    g_mutex_lock(&file->info_mutex);
+    SampleInfo sample_info = file->sample_info;
+    gboolean estimated = file->info_estimated;
+    g_mutex_unlock(&file->info_mutex);
+
+    SampleInfo *si = &sample_info;
 
     char *duration = do_format_duration((uint64_t)si->numBytes * 1000 / (uint64_t)si->avgBytesPerSec);
 
@@ -183,31 +368,552 @@ format_print_file_info(OpenedAudioFile *file)
     if (file->details) {
         printf("Format details: %s\n", file->details);
     }
-    printf("Duration:       %s (%lu samples)\n", duration, si->numBytes / si->blockAlign);
+    printf("Duration:       %s (%lu samples%s)\n", duration, si->numBytes / si->blockAlign,
+            estimated ? ", estimated" : "");
     printf("Format:         %d Hz / %d ch / %d bit",
             si->samplesPerSec,
             si->channels,
             si->bitsPerSample);
 
+    if (si->isFloat) {
+        printf(" float");
+    }
+
     printf("\n");
 
     g_free(duration);
 }
 
+gboolean
+format_set_info_changed_callback(OpenedAudioFile *file, format_info_changed_func callback, void *user_data)
+{
+    g_mutex_lock(&file->info_mutex);
+    gboolean estimated = file->info_estimated;
+    if (estimated) {
+        file->info_changed = callback;
+        file->info_changed_user_data = user_data;
+    }
+    g_mutex_unlock(&file->info_mutex);
+
+    return estimated;
+}
+
 void
 format_close_file(OpenedAudioFile *file)
 {
+    /* the format module might still be working on it in the background */
+    format_set_info_changed_callback(file, NULL, NULL);
+
     file->mod->close_file(file->mod, file);
 }
 
+/* Returns the cache for decoded samples (see appconfig_get_cache_decoded_audio()), or NULL */
+static PcmCache *
+format_get_pcm_cache(OpenedAudioFile *file)
+{
+    /* only for formats that are decoded, once the length of the decoded data is known */
+    if (file->mod->map_samples != NULL || file->mod->get_file_range != NULL || file->mod->big_endian ||
+            !appconfig_get_cache_decoded_audio()) {
+        return NULL;
+    }
+
+    g_mutex_lock(&file->info_mutex);
+    PcmCache *cache = file->pcm_cache;
+    gboolean create = (cache == NULL && !file->pcm_cache_unavailable && !file->info_estimated);
+    uint64_t size = file->sample_info.numBytes;
+    g_mutex_unlock(&file->info_mutex);
+
+    if (!create) {
+        return cache;
+    }
+
+    /* created without holding info_mutex, so that readers and the length scan are not blocked */
+    PcmCache *new_cache = pcm_cache_new(size, PCM_CACHE_REGION_FRAMES * file->sample_info.blockAlign);
+
+    g_mutex_lock(&file->info_mutex);
+    if (file->pcm_cache == NULL && !file->pcm_cache_unavailable) {
+        file->pcm_cache = g_steal_pointer(&new_cache);
+        file->pcm_cache_unavailable = (file->pcm_cache == NULL);
+    }
+    cache = file->pcm_cache;
+    g_mutex_unlock(&file->info_mutex);
+
+    /* another thread was faster */
+    if (new_cache != NULL) {
+        pcm_cache_free(new_cache);
+    }
+
+    return cache;
+}
+
+/* Decodes a whole region into the cache, using decoder if not NULL (or the shared decoder otherwise) */
+static gboolean
+format_cache_fill_region(OpenedAudioFile *file, FormatDecoder *decoder, PcmCache *cache, uint64_t region)
+{
+    uint64_t offset = region * pcm_cache_get_region_size(cache);
+    size_t length = MIN(pcm_cache_get_region_size(cache), pcm_cache_get_size(cache) - offset);
+    unsigned char *data = pcm_cache_get_data(cache, offset);
+    size_t filled = 0;
+
+    if (!pcm_cache_reserve_region(cache, region)) {
+        return FALSE;
+    }
+
+    /**
+     * If two threads fill the same region at once, both write the same
+     * samples, and readers only access the region once it has been marked.
+     **/
+    while (filled < length) {
+        long ret;
+
+        if (decoder != NULL) {
+            ret = file->mod->decoder_read_samples(decoder, data + filled, length - filled, offset + filled);
+        } else {
+            ret = file->mod->read_samples(file, data + filled, length - filled, offset + filled);
+        }
+
+        if (ret <= 0) {
+            return FALSE;
+        }
+
+        filled += ret;
+    }
+
+    pcm_cache_set_valid(cache, region);
+
+    return TRUE;
+}
+
+/**
+ * Returns a pointer to the cached samples from start_pos on (decoding the
+ * regions that haven't been cached yet) and clamps *buf_size, or NULL if
+ * the samples are not cached (then *buf_size is left unchanged).
+ **/
+static const unsigned char *
+format_cache_samples(OpenedAudioFile *file, FormatDecoder *decoder, unsigned long start_pos, size_t *buf_size)
+{
+    PcmCache *cache = format_get_pcm_cache(file);
+
+    if (cache == NULL || start_pos >= pcm_cache_get_size(cache)) {
+        return NULL;
+    }
+
+    size_t region_size = pcm_cache_get_region_size(cache);
+    uint64_t end = MIN(pcm_cache_get_size(cache), (uint64_t)start_pos + *buf_size);
+
+    /* regions are adjacent in the cache, so any range of valid regions can be returned at once */
+    for (uint64_t region = start_pos / region_size; region * region_size < end; ++region) {
+        if (!pcm_cache_is_valid(cache, region) && !format_cache_fill_region(file, decoder, cache, region)) {
+            end = MAX(start_pos, region * region_size);
+            break;
+        }
+    }
+
+    if (end == start_pos) {
+        return NULL;
+    }
+
+    *buf_size = end - start_pos;
+
+    return pcm_cache_get_data(cache, start_pos);
+}
+
 long
 format_read_samples(OpenedAudioFile *file, unsigned char *buf, size_t buf_size, unsigned long start_pos)
 {
+    const unsigned char *cached = format_cache_samples(file, NULL, start_pos, &buf_size);
+
+    if (cached != NULL) {
+        memcpy(buf, cached, buf_size);
+        return buf_size;
+    }
+
     return file->mod->read_samples(file, buf, buf_size, start_pos);
 }
 
+/* samples in the byte order of the file, see FormatModule.big_endian */
+static const unsigned char *
+format_map_native_samples(OpenedAudioFile *file, unsigned long start_pos, size_t *buf_size)
+{
+    if (file->mod->map_samples == NULL) {
+        return NULL;
+    }
+
+    return file->mod->map_samples(file, start_pos, buf_size);
+}
+
+const unsigned char *
+format_map_samples(OpenedAudioFile *file, unsigned long start_pos, size_t *buf_size)
+{
+    if (file->mod->big_endian) {
+        return NULL;
+    }
+
+    return format_map_native_samples(file, start_pos, buf_size);
+}
+
+gboolean
+format_supports_parallel_read(OpenedAudioFile *file)
+{
+    /* PCM readers use their own stream or the shared mapping */
+    if (file->mod->get_file_range != NULL || file->mod->map_samples != NULL) {
+        return TRUE;
+    }
+
+    return file->mod->parallel_decode && file->mod->open_decoder != NULL;
+}
+
+gboolean
+format_can_write_file(OpenedAudioFile *file, char **error_message)
+{
+    if (file->mod->can_write_file == NULL) {
+        return TRUE;
+    }
+
+    return file->mod->can_write_file(file, error_message);
+}
+
+uint32_t
+format_get_output_clone_block_size(OpenedAudioFile *file, const char *output_dir)
+{
+    if (!file->mod->aligned_output || !appconfig_get_align_wav_data()) {
+        return 0;
+    }
+
+    return io_get_clone_block_size(file->fp, output_dir);
+}
+
 int
 format_write_file(OpenedAudioFile *file, const char *output_filename, unsigned long start_pos, unsigned long end_pos, report_progress_func report_progress, void *report_progress_user_data)
 {
     return file->mod->write_file(file, output_filename, start_pos, end_pos, report_progress, report_progress_user_data);
 }
+
+FormatReader *
+format_reader_open(OpenedAudioFile *file, unsigned long start_pos)
+{
+    FormatReader *reader = g_new0(FormatReader, 1);
+
+    reader->file = file;
+    reader->position = start_pos;
+
+    /* mapped samples are returned without copying, read-ahead is only used if mapping failed */
+    size_t mapped_size = 1;
+    reader->mapped = (format_map_native_samples(file, start_pos, &mapped_size) != NULL);
+    if (reader->mapped) {
+        return reader;
+    }
+
+    uint64_t offset, length;
+    if (file->mod->get_file_range != NULL && file->mod->get_file_range(file, start_pos, &offset, &length)) {
+        reader->stream = io_read_stream_open(file->fp, offset, length);
+    } else if (file->mod->open_decoder != NULL) {
+        // if this fails, the shared decoder is used via format_read_samples()
+        reader->decoder = file->mod->open_decoder(file);
+    }
+
+    return reader;
+}
+
+static long
+format_reader_read_stream(FormatReader *reader, unsigned char *buf, size_t buf_size, gboolean swap)
+{
+    if (reader->stream_avail == 0) {
+        gssize ret = io_read_stream_next(reader->stream, &reader->stream_data);
+        if (ret <= 0) {
+            return ret;
+        }
+
+        reader->stream_avail = ret;
+    }
+
+    size_t len = MIN(buf_size, reader->stream_avail);
+
+    if (swap) {
+        pcm_convert_swap16(reader->stream_data, buf, len);
+    } else {
+        memcpy(buf, reader->stream_data, len);
+    }
+    reader->stream_data += len;
+    reader->stream_avail -= len;
+
+    return len;
+}
+
+/* copies mapped samples into the buffer (only needed if they have to be swapped) */
+static long
+format_reader_read_mapped(FormatReader *reader, unsigned char *buf, size_t buf_size, gboolean swap)
+{
+    const unsigned char *mapped = format_map_native_samples(reader->file,
+            reader->position + reader->buf_fill, &buf_size);
+    if (mapped == NULL) {
+        return -1;
+    }
+
+    if (swap) {
+        pcm_convert_swap16(mapped, buf, buf_size);
+    } else {
+        memcpy(buf, mapped, buf_size);
+    }
+
+    return buf_size;
+}
+
+static gboolean
+format_reader_fill(FormatReader *reader, size_t buf_size, gboolean big_endian)
+{
+    size_t available = reader->buf_fill - reader->buf_offset;
+
+    if (reader->buf == NULL) {
+        reader->buf = g_malloc(READER_BUF_SIZE);
+    }
+
+    memmove(reader->buf, reader->buf + reader->buf_offset, available);
+    reader->buf_offset = 0;
+    reader->buf_fill = available;
+
+    if (reader->buf_big_endian != big_endian) {
+        pcm_convert_swap16(reader->buf, reader->buf, reader->buf_fill);
+        reader->buf_big_endian = big_endian;
+    }
+
+    while (!reader->eof && reader->buf_fill < buf_size) {
+        unsigned char *buf = reader->buf + reader->buf_fill;
+        long ret;
+
+        if (reader->stream != NULL) {
+            /* the stream has the samples as stored in the file */
+            ret = format_reader_read_stream(reader, buf, READER_BUF_SIZE - reader->buf_fill,
+                    reader->file->mod->big_endian && !big_endian);
+        } else if (reader->mapped) {
+            /* the mapping has the samples as stored in the file, too */
+            ret = format_reader_read_mapped(reader, buf, READER_BUF_SIZE - reader->buf_fill,
+                    reader->file->mod->big_endian && !big_endian);
+        } else {
+            if (reader->decoder != NULL) {
+                ret = reader->file->mod->decoder_read_samples(reader->decoder, buf,
+                        READER_BUF_SIZE - reader->buf_fill, reader->position + reader->buf_fill);
+            } else {
+                ret = format_read_samples(reader->file, buf,
+                        READER_BUF_SIZE - reader->buf_fill, reader->position + reader->buf_fill);
+            }
+
+            /* read_samples() always returns little-endian samples */
+            if (ret > 0 && big_endian) {
+                pcm_convert_swap16(buf, buf, ret);
+            }
+        }
+
+        if (ret < 0) {
+            return FALSE;
+        } else if (ret == 0) {
+            reader->eof = TRUE;
+        }
+
+        reader->buf_fill += ret;
+    }
+
+    return TRUE;
+}
+
+/* big_endian can only be TRUE for big-endian format modules, to get the samples without swapping */
+static long
+format_reader_next_with_byte_order(FormatReader *reader, const unsigned char **samples, size_t buf_size, gboolean big_endian)
+{
+    if (buf_size > READER_BUF_SIZE) {
+        buf_size = READER_BUF_SIZE;
+    }
+
+    if (reader->buf == NULL && reader->stream == NULL && big_endian == reader->file->mod->big_endian) {
+        const unsigned char *mapped = format_map_native_samples(reader->file, reader->position, &buf_size);
+        if (mapped == NULL) {
+            mapped = format_cache_samples(reader->file, reader->decoder, reader->position, &buf_size);
+        }
+
+        if (mapped != NULL) {
+            *samples = mapped;
+            reader->position += buf_size;
+            return buf_size;
+        }
+    }
+
+    if (reader->buf_fill - reader->buf_offset < buf_size || reader->buf_big_endian != big_endian) {
+        if (!format_reader_fill(reader, buf_size, big_endian) && reader->buf_fill == 0) {
+            return -1;
+        }
+    }
+
+    if (buf_size > reader->buf_fill - reader->buf_offset) {
+        buf_size = reader->buf_fill - reader->buf_offset;
+    }
+
+    *samples = reader->buf + reader->buf_offset;
+    reader->buf_offset += buf_size;
+    reader->position += buf_size;
+
+    return buf_size;
+}
+
+long
+format_reader_next(FormatReader *reader, const unsigned char **samples, size_t buf_size)
+{
+    return format_reader_next_with_byte_order(reader, samples, buf_size, FALSE);
+}
+
+void
+format_reader_close(FormatReader *reader)
+{
+    if (reader->stream != NULL) {
+        io_read_stream_close(reader->stream);
+    }
+
+    if (reader->decoder != NULL) {
+        reader->file->mod->close_decoder(reader->decoder);
+    }
+
+    g_free(reader->buf);
+    g_free(reader);
+}
+
+static const PcmConverter *
+format_get_pcm_converter(OpenedAudioFile *file)
+{
+    if (file->pcm_converter == NULL) {
+        file->pcm_converter = pcm_converter_get(&file->sample_info);
+    }
+
+    return file->pcm_converter;
+}
+
+static const PcmConverter *
+format_get_native_pcm_converter(OpenedAudioFile *file)
+{
+    if (!file->mod->big_endian) {
+        return format_get_pcm_converter(file);
+    }
+
+    if (file->native_pcm_converter == NULL) {
+        file->native_pcm_converter = pcm_converter_get_big_endian(&file->sample_info);
+    }
+
+    return file->native_pcm_converter;
+}
+
+static long
+format_read_frames(OpenedAudioFile *file, unsigned long start_frame, size_t num_frames,
+        void (*convert)(const PcmConverter *, const unsigned char *, void *const [], size_t, unsigned int),
+        void *const planes[])
+{
+    const PcmConverter *converter = format_get_native_pcm_converter(file);
+    SampleInfo *si = &file->sample_info;
+
+    size_t buf_size = num_frames * si->blockAlign;
+    unsigned long start_pos = start_frame * si->blockAlign;
+
+    /* mapped samples are converted from the byte order in the file */
+    const unsigned char *samples = format_map_native_samples(file, start_pos, &buf_size);
+    unsigned char *buf = NULL;
+    long ret;
+
+    if (samples != NULL) {
+        ret = buf_size;
+    } else {
+        converter = format_get_pcm_converter(file);
+        samples = buf = g_malloc(buf_size);
+        ret = format_read_samples(file, buf, buf_size, start_pos);
+    }
+
+    if (converter == NULL) {
+        ret = -1;
+    } else if (ret > 0) {
+        ret /= si->blockAlign;
+        convert(converter, samples, planes, ret, si->channels);
+    }
+
+    g_free(buf);
+
+    return ret;
+}
+
+static long
+format_reader_next_frames(FormatReader *reader, size_t num_frames,
+        void (*convert)(const PcmConverter *, const unsigned char *, void *const [], size_t, unsigned int),
+        void *const planes[])
+{
+    /* samples are converted from the byte order in the file, without swapping them first */
+    const PcmConverter *converter = format_get_native_pcm_converter(reader->file);
+    SampleInfo *si = &reader->file->sample_info;
+
+    if (converter == NULL) {
+        return -1;
+    }
+
+    const unsigned char *samples;
+    long ret = format_reader_next_with_byte_order(reader, &samples, num_frames * si->blockAlign,
+            reader->file->mod->big_endian);
+
+    if (ret > 0) {
+        ret /= si->blockAlign;
+        convert(converter, samples, planes, ret, si->channels);
+    }
+
+    return ret;
+}
+
+long
+format_reader_next_peak_s32(FormatReader *reader, size_t num_frames, int32_t *min, int32_t *max)
+{
+    const PcmConverter *converter = format_get_native_pcm_converter(reader->file);
+    SampleInfo *si = &reader->file->sample_info;
+
+    if (converter == NULL) {
+        return -1;
+    }
+
+    const unsigned char *samples;
+    long ret = format_reader_next_with_byte_order(reader, &samples, num_frames * si->blockAlign,
+            reader->file->mod->big_endian);
+
+    if (ret > 0) {
+        ret /= si->blockAlign;
+        converter->peak_s32(samples, ret, si->channels, min, max);
+    }
+
+    return ret;
+}
+
+static void
+convert_f32(const PcmConverter *converter, const unsigned char *src, void *const planes[], size_t num_frames, unsigned int channels)
+{
+    converter->to_f32(src, (float *const *)planes, num_frames, channels);
+}
+
+static void
+convert_s32(const PcmConverter *converter, const unsigned char *src, void *const planes[], size_t num_frames, unsigned int channels)
+{
+    converter->to_s32(src, (int32_t *const *)planes, num_frames, channels);
+}
+
+long
+format_read_frames_f32(OpenedAudioFile *file, float *const planes[], size_t num_frames, unsigned long start_frame)
+{
+    return format_read_frames(file, start_frame, num_frames, convert_f32, (void *const *)planes);
+}
+
+long
+format_read_frames_s32(OpenedAudioFile *file, int32_t *const planes[], size_t num_frames, unsigned long start_frame)
+{
+    return format_read_frames(file, start_frame, num_frames, convert_s32, (void *const *)planes);
+}
+
+long
+format_reader_next_frames_f32(FormatReader *reader, float *const planes[], size_t num_frames)
+{
+    return format_reader_next_frames(reader, num_frames, convert_f32, (void *const *)planes);
+}
+
+long
+format_reader_next_frames_s32(FormatReader *reader, int32_t *const planes[], size_t num_frames)
+{
+    return format_reader_next_frames(reader, num_frames, convert_s32, (void *const *)planes);
+}
@@ -19,6 +19,8 @@
 #pragma once
 
 #include "sample_info.h"
+#include "pcm_convert.h"
+#include "pcm_cache.h"
 
 #include <stdio.h>
 #include <stdint.h>
@@ -27,18 +29,56 @@
 
 typedef struct FormatModule_ FormatModule;
 typedef struct OpenedAudioFile_ OpenedAudioFile;
+typedef struct FormatReader_ FormatReader;
+typedef struct FormatDecoder_ FormatDecoder;
 
 typedef void (*report_progress_func)(double progress, void *user_data);
+typedef void (*format_info_changed_func)(OpenedAudioFile *file, void *user_data);
+
+/* Number of bytes at the start of the file that are passed to probe() */
+#define FORMAT_PROBE_SIZE 4096
+
+/* Scores returned from probe(), the highest-scoring module is tried first */
+#define FORMAT_PROBE_SCORE_NONE 0
+#define FORMAT_PROBE_SCORE_EXTENSION 25
+#define FORMAT_PROBE_SCORE_LIKELY 50
+#define FORMAT_PROBE_SCORE_MAX 100
 
 struct FormatModule_ {
     const char *name;
     const char *library_name;
     const char *default_file_extension;
 
+    /* optional: cheap check of the file head (up to FORMAT_PROBE_SIZE bytes), returns a score;
+     * modules with score FORMAT_PROBE_SCORE_NONE are not opened at all */
+    int (*probe)(const FormatModule *self, const char *filename, const unsigned char *head, size_t head_size);
     OpenedAudioFile *(*open_file)(const FormatModule *self, const char *filename, char **error_message);
     void (*close_file)(const FormatModule *self, OpenedAudioFile *file);
 
+    /* samples are returned interleaved, little-endian, in the format described by sample_info */
     long (*read_samples)(OpenedAudioFile *self, unsigned char *buf, size_t buf_size, unsigned long start_pos);
+    /* optional: returns a read-only pointer into a memory-mapped view of the samples (in the same
+     * layout as read_samples() would return them) and clamps *buf_size, or NULL if not available */
+    const unsigned char *(*map_samples)(OpenedAudioFile *self, unsigned long start_pos, size_t *buf_size);
+    /* optional: if samples are stored in the file as read_samples() would return them, gets the
+     * file offset of start_pos and the number of sample bytes from there on (for read-ahead) */
+    gboolean (*get_file_range)(OpenedAudioFile *self, unsigned long start_pos, uint64_t *offset, uint64_t *length);
+    /* optional: for formats with decoder state (where read_samples() has to be serialized), creates
+     * an independent decoder instance, so that several threads can decode the same file at once */
+    FormatDecoder *(*open_decoder)(OpenedAudioFile *self);
+    long (*decoder_read_samples)(FormatDecoder *decoder, unsigned char *buf, size_t buf_size, unsigned long start_pos);
+    void (*close_decoder)(FormatDecoder *decoder);
+    /* set if decoders return exact samples starting at any position, so that
+     * disjoint ranges of the file can be decoded on multiple threads at once */
+    gboolean parallel_decode;
+    /* set if the samples in the file (as returned by map_samples() and get_file_range()) are 16-bit
+     * big-endian; read_samples() swaps them, while the frame-based functions convert them directly */
+    gboolean big_endian;
+    /* set if write_file() places the samples at the same offset within a file system block as in
+     * the file when appconfig_get_align_wav_data() is enabled, so that io_copy() can clone them */
+    gboolean aligned_output;
+    /* optional: checks if write_file() supports this file, sets *error_message if it doesn't */
+    gboolean (*can_write_file)(OpenedAudioFile *self, char **error_message);
     int (*write_file)(OpenedAudioFile *self, const char *output_filename, unsigned long start_pos, unsigned long end_pos, report_progress_func report_progress, void *report_progress_user_data);
 };
 
@@ -55,6 +95,24 @@ struct OpenedAudioFile_ {
     SampleInfo sample_info;
     char *details;
     uint64_t file_size;
+    GMappedFile *mapped_file;
+    const PcmConverter *pcm_converter;
+    /* for the samples as stored in the file, differs from pcm_converter for big-endian modules */
+    const PcmConverter *native_pcm_converter;
+
+    /* decoded samples of formats that can't be mapped, created on first use (protected by info_mutex) */
+    PcmCache *pcm_cache;
+    gboolean pcm_cache_unavailable;
+
+    /* set while sample_info.numBytes is only an estimate, see format_set_info_changed_callback() */
+    GMutex info_mutex;
+    gboolean info_estimated;
+    format_info_changed_func info_changed;
+    void *info_changed_user_data;
+};
+
+struct FormatDecoder_ {
+    OpenedAudioFile *file;
 };
 
 gboolean
@@ -63,9 +121,23 @@ format_module_filename_extension_check(const FormatModule *self, const char *fil
 gboolean
 format_module_open_file(const FormatModule *self, OpenedAudioFile *file, const char *filename, char **error_message);
 
+gboolean
+format_module_map_file(OpenedAudioFile *file);
+
+const unsigned char *
+format_module_get_mapped_data(OpenedAudioFile *file, uint64_t offset, uint64_t length, size_t *buf_size);
+
 void
 opened_audio_file_close(OpenedAudioFile *file);
 
+/* For modules that open files with an estimated length and determine the exact length later */
+void
+format_module_set_info_estimated(OpenedAudioFile *file);
+
+/* Sets the exact length (can be called from any thread) and calls the info changed callback */
+void
+format_module_set_exact_num_bytes(OpenedAudioFile *file, unsigned long num_bytes);
+
 
 /* Public API */
 
@@ -81,11 +153,92 @@ format_open_file(const char *filename, char **error_message);
 void
 format_print_file_info(OpenedAudioFile *file);
 
+/**
+ * If the format module could only estimate the length of the file when
+ * opening it (sample_info.numBytes), the exact length is determined in the
+ * background. In that case, this function returns TRUE and callback will be
+ * called (from another thread) once sample_info has been updated. Returns
+ * FALSE if the length is already exact, and the callback will not be called.
+ * The callback must not call any format functions. It is not called anymore
+ * once format_close_file() has returned.
+ **/
+gboolean
+format_set_info_changed_callback(OpenedAudioFile *file, format_info_changed_func callback, void *user_data);
+
 void
 format_close_file(OpenedAudioFile *file);
 
 long
 format_read_samples(OpenedAudioFile *file, unsigned char *buf, size_t buf_size, unsigned long start_pos);
 
+const unsigned char *
+format_map_samples(OpenedAudioFile *file, unsigned long start_pos, size_t *buf_size);
+
+/* TRUE if readers on disjoint ranges of the file can be used from several threads without serializing */
+gboolean
+format_supports_parallel_read(OpenedAudioFile *file);
+
+/**
+ * format_read_samples() and the FormatReader functions can be used from
+ * multiple threads at once on the same file (each reader may only be used
+ * by one thread at a time).
+ *
+ * Sequential reader: Returns consecutive chunks of samples starting at start_pos
+ * (in the same layout as format_read_samples()). Data is served from the
+ * memory mapping if available, otherwise read ahead from the file if the format
+ * module supports it, or from a large internal buffer that is refilled with
+ * sequential reads, so that the format module never has to seek in between. For formats
+ * with decoder state, each reader has its own decoder instance.
+ *
+ * format_reader_next() sets *samples to the next buf_size bytes (fewer only at
+ * the end of the file) and returns the number of bytes available, 0 at the end
+ * of the file or -1 on error. The pointer is only valid until the next call.
+ **/
+FormatReader *
+format_reader_open(OpenedAudioFile *file, unsigned long start_pos);
+
+long
+format_reader_next(FormatReader *reader, const unsigned char **samples, size_t buf_size);
+
+void
+format_reader_close(FormatReader *reader);
+
+/**
+ * Decoding into planar buffers (one per channel, each num_frames long), see
+ * pcm_convert.h for the value ranges. Returns the number of frames decoded,
+ * 0 at the end of the file or -1 on error (or if the format is unsupported).
+ **/
+long
+format_read_frames_f32(OpenedAudioFile *file, float *const planes[], size_t num_frames, unsigned long start_frame);
+
+long
+format_read_frames_s32(OpenedAudioFile *file, int32_t *const planes[], size_t num_frames, unsigned long start_frame);
+
+long
+format_reader_next_frames_f32(FormatReader *reader, float *const planes[], size_t num_frames);
+
+long
+format_reader_next_frames_s32(FormatReader *reader, int32_t *const planes[], size_t num_frames);
+
+/**
+ * Minimum and maximum of the first channel of the next num_frames frames (in
+ * the range of format_reader_next_frames_s32()), without converting the samples.
+ * Returns the number of frames like format_reader_next_frames_s32().
+ **/
+long
+format_reader_next_peak_s32(FormatReader *reader, size_t num_frames, int32_t *min, int32_t *max);
+
+/* FALSE (with *error_message set) if the file can be opened, but not split */
+gboolean
+format_can_write_file(OpenedAudioFile *file, char **error_message);
+
+/**
+ * Block size of the file system if format_write_file() can share whole blocks
+ * of sample data with the file when writing into output_dir (instead of
+ * copying them, see io_copy()), or 0 if all data will be copied.
+ **/
+uint32_t
+format_get_output_clone_block_size(OpenedAudioFile *file, const char *output_dir);
+
 int
 format_write_file(OpenedAudioFile *file, const char *output_filename, unsigned long start_pos, unsigned long end_pos, report_progress_func report_progress, void *report_progress_user_data);
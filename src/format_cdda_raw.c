@@ -18,9 +18,11 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 #include <sys/stat.h>
 
 #include "format_cdda_raw.h"
+#include "io_engine.h"
 
 
 /**
@@ -48,6 +50,17 @@ cdda_raw_close_file(const FormatModule *self, OpenedAudioFile *file)
     g_free(cdda);
 }
 
+static int
+cdda_raw_probe(const FormatModule *self, const char *filename, const unsigned char *head, size_t head_size)
+{
+    /* raw audio has no header, so we can only go by the file extension */
+    if (format_module_filename_extension_check(self, filename, NULL)) {
+        return FORMAT_PROBE_SCORE_EXTENSION;
+    }
+
+    return FORMAT_PROBE_SCORE_NONE;
+}
+
 static OpenedAudioFile *
 cdda_raw_open_file(const FormatModule *self, const char *filename, char **error_message)
 {
@@ -82,6 +95,8 @@ cdda_raw_open_file(const FormatModule *self, const char *filename, char **error_
     si->blockAlign = 4;
     si->blockSize = si->avgBytesPerSec / CD_BLOCKS_PER_SEC;
 
+    format_module_map_file(&cdda->hdr);
+
     return &cdda->hdr;
 
 error:
@@ -95,102 +110,95 @@ cdda_raw_read_samples(OpenedAudioFile *self, unsigned char *buf, size_t buf_size
 {
     OpenedCDDAFile *cdda = (OpenedCDDAFile *)self;
 
-    size_t i = 0;
     size_t ret;
 
-    if (fseek(cdda->hdr.fp, start_pos, SEEK_SET)) {
-        return -1;
-    }
-
     if (start_pos > cdda->file_size) {
         return -1;
     }
 
-    ret = fread(buf, 1, buf_size, cdda->hdr.fp);
-
-#if G_BYTE_ORDER == G_LITTLE_ENDIAN
-    for (i = 0; i < ret / 4; i++) {
-        unsigned char tmp;
-
-        /* left channel */
-        tmp = buf[i*4+0];
-        buf[i*4+0] = buf[i*4+1];
-        buf[i*4+1] = tmp;
+    /* CDDA samples are stored big-endian, read_samples() returns little-endian */
+    const unsigned char *mapped = format_module_get_mapped_data(&cdda->hdr, start_pos, cdda->file_size - start_pos, &buf_size);
+    if (mapped != NULL) {
+        pcm_convert_swap16(mapped, buf, buf_size);
+        ret = buf_size;
+    } else {
+        /* positional read, so that multiple threads can read at once */
+        gssize res = io_pread(cdda->hdr.fp, buf, buf_size, start_pos);
+        if (res < 0) {
+            return -1;
+        }
 
-        /* right channel */
-        tmp = buf[i*4+2];
-        buf[i*4+2] = buf[i*4+3];
-        buf[i*4+3] = tmp;
+        ret = res;
+        pcm_convert_swap16(buf, buf, ret);
     }
-#endif /* G_LITTLE_ENDIAN */
 
     return ret;
 }
 
-int
-cdda_raw_write_file(OpenedAudioFile *self, const char *output_filename, unsigned long start_pos, unsigned long end_pos, report_progress_func report_progress, void *report_progress_user_data)
+static const unsigned char *
+cdda_raw_map_samples(OpenedAudioFile *self, unsigned long start_pos, size_t *buf_size)
 {
     OpenedCDDAFile *cdda = (OpenedCDDAFile *)self;
 
-    int buf_size = cdda->hdr.sample_info.blockSize;
+    if (start_pos > cdda->file_size) {
+        return NULL;
+    }
 
-    size_t ret;
-    FILE *new_fp;
-    unsigned long cur_pos;
-    unsigned char buf[buf_size];
+    return format_module_get_mapped_data(&cdda->hdr, start_pos, cdda->file_size - start_pos, buf_size);
+}
 
-    if (end_pos == 0) {
-        if (fseek(cdda->hdr.fp, 0, SEEK_END)) {
-            return -1;
-        }
+static gboolean
+cdda_raw_get_file_range(OpenedAudioFile *self, unsigned long start_pos, uint64_t *offset, uint64_t *length)
+{
+    OpenedCDDAFile *cdda = (OpenedCDDAFile *)self;
 
-        end_pos = ftell(cdda->hdr.fp);
+    if (start_pos > cdda->file_size) {
+        return FALSE;
     }
 
-    if ((new_fp = fopen(output_filename, "wb")) == NULL) {
-        g_warning("Error opening %s for writing", output_filename);
-        return -1;
-    }
+    *offset = start_pos;
+    *length = cdda->file_size - start_pos;
 
-    cur_pos = start_pos;
+    return TRUE;
+}
 
-    if (fseek(cdda->hdr.fp, cur_pos, SEEK_SET)) {
-        fclose(new_fp);
-        return -1;
-    }
+int
+cdda_raw_write_file(OpenedAudioFile *self, const char *output_filename, unsigned long start_pos, unsigned long end_pos, report_progress_func report_progress, void *report_progress_user_data)
+{
+    OpenedCDDAFile *cdda = (OpenedCDDAFile *)self;
 
-    report_progress(0.0, report_progress_user_data);
+    IoOutputFile *output;
 
-    if (cur_pos > cdda->file_size) {
-        fclose(new_fp);
+    if (start_pos > cdda->file_size) {
         return -1;
     }
 
-    if (cur_pos + buf_size > end_pos) {
-        buf_size = end_pos - cur_pos;
+    if (end_pos == 0 || end_pos > cdda->file_size) {
+        end_pos = cdda->file_size;
     }
 
-    while ((ret = fread(buf, 1, buf_size, cdda->hdr.fp)) > 0 &&
-            cur_pos < end_pos) {
-
-        if ((fwrite(buf, 1, ret, new_fp)) < ret) {
-            g_warning("Error writing to file %s", output_filename);
-            fclose(new_fp);
-            return -1;
-        }
-        cur_pos += ret;
+    if ((output = io_output_open(output_filename, end_pos - start_pos)) == NULL) {
+        g_warning("Error opening %s for writing", output_filename);
+        return -1;
+    }
 
-        report_progress((double)(cur_pos - start_pos) / (double)(end_pos - start_pos), report_progress_user_data);
+    report_progress(0.0, report_progress_user_data);
 
-        if (cur_pos + buf_size > end_pos) {
-            buf_size = end_pos - cur_pos;
-        }
+    if (io_copy(cdda->hdr.fp, start_pos, io_output_get_fp(output), 0, end_pos - start_pos,
+                report_progress, report_progress_user_data) < 0) {
+        g_warning("Error writing to file %s", output_filename);
+        io_output_close(output);
+        return -1;
     }
 
     report_progress(1.0, report_progress_user_data);
 
-    fclose(new_fp);
-    return ret;
+    if (!io_output_close(output)) {
+        g_warning("Error writing to file %s", output_filename);
+        return -1;
+    }
+
+    return 0;
 }
 
 static const FormatModule
@@ -199,10 +207,14 @@ CDDA_RAW_FORMAT_MODULE = {
     .library_name = "built-in",
     .default_file_extension = ".cdda.raw",
 
+    .probe = cdda_raw_probe,
     .open_file = cdda_raw_open_file,
     .close_file = cdda_raw_close_file,
 
     .read_samples = cdda_raw_read_samples,
+    .map_samples = cdda_raw_map_samples,
+    .get_file_range = cdda_raw_get_file_range,
+    .big_endian = TRUE,
     .write_file = cdda_raw_write_file,
 };
 
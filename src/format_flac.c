@@ -0,0 +1,542 @@
+/* wavbreaker - A tool to split a wave file up into multiple waves.
+ * Copyright (C) 2022 Thomas Perl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <config.h>
+
+#include "format_flac.h"
+
+#if defined(HAVE_FLAC)
+
+#include <FLAC/stream_decoder.h>
+#include <FLAC/stream_encoder.h>
+#include <FLAC/metadata.h>
+
+#include <stdint.h>
+#include <string.h>
+
+/* Number of frames re-encoded at once in flac_write_file() */
+#define FLAC_WRITE_CHUNK_FRAMES (64 * 1024)
+
+/* Distance between seek points in written files, in seconds */
+#define FLAC_SEEK_POINT_INTERVAL 10
+
+
+typedef struct FlacDecoder_ FlacDecoder;
+struct FlacDecoder_ {
+    FormatDecoder hdr;
+
+    FLAC__StreamDecoder *flac;
+    unsigned long flac_offset;
+
+    /* filled from the metadata callback */
+    FLAC__StreamMetadata_StreamInfo stream_info;
+    gboolean have_stream_info;
+    unsigned int seek_points;
+
+    /* last decoded frame, interleaved in the output sample format */
+    unsigned char *frame_buf;
+    size_t frame_buf_size;
+    size_t frame_fill;
+    size_t frame_offset;
+};
+
+typedef struct OpenedFlacFile_ OpenedFlacFile;
+struct OpenedFlacFile_ {
+    OpenedAudioFile hdr;
+
+    /* bits per sample of the encoded stream (sample_info has it rounded up to bytes) */
+    unsigned int flac_bits_per_sample;
+
+    /* decoder used by flac_read_samples(), and the lock for it */
+    FlacDecoder *decoder;
+    GMutex decoder_mutex;
+};
+
+static FLAC__StreamDecoderWriteStatus
+flac_decoder_write_callback(const FLAC__StreamDecoder *flac, const FLAC__Frame *frame, const FLAC__int32 *const buffer[], void *client_data)
+{
+    FlacDecoder *dec = client_data;
+    SampleInfo *si = &dec->hdr.file->sample_info;
+
+    if (frame->header.channels != si->channels || frame->header.bits_per_sample != dec->stream_info.bits_per_sample) {
+        g_warning("FLAC frame format (%u ch, %u bit) differs from stream format",
+                frame->header.channels, frame->header.bits_per_sample);
+        return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
+    }
+
+    size_t size = (size_t)frame->header.blocksize * si->blockAlign;
+    if (size > dec->frame_buf_size) {
+        dec->frame_buf = g_realloc(dec->frame_buf, size);
+        dec->frame_buf_size = size;
+    }
+
+    unsigned int bytes_per_sample = si->bitsPerSample / 8;
+    unsigned int shift = si->bitsPerSample - frame->header.bits_per_sample;
+    unsigned char *dst = dec->frame_buf;
+
+    for (unsigned int i = 0; i < frame->header.blocksize; ++i) {
+        for (unsigned int ch = 0; ch < si->channels; ++ch) {
+            uint32_t value = (uint32_t)buffer[ch][i] << shift;
+
+            if (bytes_per_sample == 1) {
+                /* 8-bit WAV samples are unsigned */
+                *dst++ = (value ^ 0x80) & 0xFF;
+            } else {
+                for (unsigned int b = 0; b < bytes_per_sample; ++b) {
+                    *dst++ = (value >> (8 * b)) & 0xFF;
+                }
+            }
+        }
+    }
+
+    dec->frame_fill = size;
+    dec->frame_offset = 0;
+
+    return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+}
+
+static void
+flac_decoder_metadata_callback(const FLAC__StreamDecoder *flac, const FLAC__StreamMetadata *metadata, void *client_data)
+{
+    FlacDecoder *dec = client_data;
+
+    if (metadata->type == FLAC__METADATA_TYPE_STREAMINFO) {
+        dec->stream_info = metadata->data.stream_info;
+        dec->have_stream_info = TRUE;
+    } else if (metadata->type == FLAC__METADATA_TYPE_SEEKTABLE) {
+        dec->seek_points = metadata->data.seek_table.num_points;
+    }
+}
+
+static void
+flac_decoder_error_callback(const FLAC__StreamDecoder *flac, FLAC__StreamDecoderErrorStatus status, void *client_data)
+{
+    FlacDecoder *dec = client_data;
+
+    g_warning("FLAC decoder error in %s: %s", dec->hdr.file->filename, FLAC__StreamDecoderErrorStatusString[status]);
+}
+
+static long
+flac_decoder_read_samples(FormatDecoder *decoder, unsigned char *buf, size_t buf_size, unsigned long start_pos)
+{
+    FlacDecoder *dec = (FlacDecoder *)decoder;
+    SampleInfo *si = &dec->hdr.file->sample_info;
+
+    if (dec->flac_offset != start_pos) {
+        FLAC__uint64 sample = start_pos / si->blockAlign;
+
+        dec->frame_fill = dec->frame_offset = 0;
+
+        if (sample >= dec->stream_info.total_samples) {
+            return 0;
+        }
+
+        /**
+         * libFLAC narrows down the position using the seek table (if there is one) and
+         * then locates the frame via its header; the write callback gets called with the
+         * frame containing the target sample, trimmed so that it starts at that sample.
+         **/
+        if (!FLAC__stream_decoder_seek_absolute(dec->flac, sample)) {
+            g_warning("Could not seek to sample %" G_GUINT64_FORMAT " in %s", (guint64)sample, dec->hdr.file->filename);
+            FLAC__stream_decoder_flush(dec->flac);
+            dec->flac_offset = (unsigned long)-1;
+            return -1;
+        }
+
+        dec->flac_offset = start_pos;
+    }
+
+    long result = 0;
+
+    while (buf_size > 0) {
+        if (dec->frame_offset == dec->frame_fill) {
+            if (FLAC__stream_decoder_get_state(dec->flac) == FLAC__STREAM_DECODER_END_OF_STREAM) {
+                break;
+            }
+
+            dec->frame_fill = dec->frame_offset = 0;
+
+            if (!FLAC__stream_decoder_process_single(dec->flac)) {
+                g_warning("Error decoding FLAC frame: %s",
+                        FLAC__StreamDecoderStateString[FLAC__stream_decoder_get_state(dec->flac)]);
+                return -1;
+            }
+
+            continue;
+        }
+
+        size_t len = MIN(buf_size, dec->frame_fill - dec->frame_offset);
+        memcpy(buf, dec->frame_buf + dec->frame_offset, len);
+
+        result += len;
+        dec->frame_offset += len;
+        dec->flac_offset += len;
+        buf += len;
+        buf_size -= len;
+    }
+
+    return result;
+}
+
+static long
+flac_read_samples(OpenedAudioFile *self, unsigned char *buf, size_t buf_size, unsigned long start_pos)
+{
+    OpenedFlacFile *flac = (OpenedFlacFile *)self;
+
+    g_mutex_lock(&flac->decoder_mutex);
+    long result = flac_decoder_read_samples(&flac->decoder->hdr, buf, buf_size, start_pos);
+    g_mutex_unlock(&flac->decoder_mutex);
+
+    return result;
+}
+
+static void
+flac_close_decoder(FormatDecoder *decoder)
+{
+    FlacDecoder *dec = (FlacDecoder *)decoder;
+
+    if (dec->flac != NULL) {
+        FLAC__stream_decoder_finish(dec->flac);
+        FLAC__stream_decoder_delete(dec->flac);
+    }
+
+    g_free(dec->frame_buf);
+    g_free(dec);
+}
+
+static FlacDecoder *
+flac_decoder_new(OpenedAudioFile *file, char **error_message)
+{
+    FlacDecoder *dec = g_new0(FlacDecoder, 1);
+
+    dec->hdr.file = file;
+    dec->flac_offset = 0;
+
+    if ((dec->flac = FLAC__stream_decoder_new()) == NULL) {
+        format_module_set_error_message(error_message, "%s", "FLAC__stream_decoder_new() failed");
+        goto error;
+    }
+
+    FLAC__stream_decoder_set_metadata_respond(dec->flac, FLAC__METADATA_TYPE_SEEKTABLE);
+
+    FLAC__StreamDecoderInitStatus status = FLAC__stream_decoder_init_file(dec->flac, file->filename,
+            flac_decoder_write_callback, flac_decoder_metadata_callback, flac_decoder_error_callback, dec);
+
+    if (status != FLAC__STREAM_DECODER_INIT_STATUS_OK) {
+        format_module_set_error_message(error_message, "FLAC__stream_decoder_init_file() failed: %s",
+                FLAC__StreamDecoderInitStatusString[status]);
+        goto error;
+    }
+
+    if (!FLAC__stream_decoder_process_until_end_of_metadata(dec->flac) || !dec->have_stream_info) {
+        format_module_set_error_message(error_message, "%s", "Could not read FLAC stream info, probably not a FLAC file");
+        goto error;
+    }
+
+    return dec;
+
+error:
+    flac_close_decoder(&dec->hdr);
+
+    return NULL;
+}
+
+static FormatDecoder *
+flac_open_decoder(OpenedAudioFile *self)
+{
+    char *error_message = NULL;
+    FlacDecoder *dec = flac_decoder_new(self, &error_message);
+
+    if (dec == NULL) {
+        g_warning("Could not set up FLAC decoder: %s", error_message);
+        g_free(error_message);
+        return NULL;
+    }
+
+    return &dec->hdr;
+}
+
+/**
+ * FLAC frames can't be cut without decoding, so the range is decoded and
+ * encoded again (the audio data is bit-identical, as FLAC is lossless).
+ **/
+static int
+flac_write_file(OpenedAudioFile *self, const char *output_filename, unsigned long start_pos, unsigned long end_pos, report_progress_func report_progress, void *report_progress_user_data)
+{
+    OpenedFlacFile *flac = (OpenedFlacFile *)self;
+    SampleInfo *si = &flac->hdr.sample_info;
+
+    FlacDecoder *dec = NULL;
+    FLAC__StreamEncoder *encoder = NULL;
+    FLAC__StreamMetadata *seek_table = NULL;
+    unsigned char *buf = NULL;
+    FLAC__int32 *samples = NULL;
+    FLAC__int32 **planes = NULL;
+    int result = -1;
+
+    const PcmConverter *converter = pcm_converter_get(si);
+    if (converter == NULL) {
+        g_warning("Unsupported sample format for writing FLAC");
+        return -1;
+    }
+
+    if (end_pos == 0 || end_pos > si->numBytes) {
+        end_pos = si->numBytes;
+    }
+
+    if (start_pos > end_pos) {
+        return -1;
+    }
+
+    uint64_t total_frames = (end_pos - start_pos) / si->blockAlign;
+
+    report_progress(0.0, report_progress_user_data);
+
+    char *error_message = NULL;
+    if ((dec = flac_decoder_new(self, &error_message)) == NULL) {
+        g_warning("Could not set up FLAC decoder: %s", error_message);
+        g_free(error_message);
+        goto cleanup;
+    }
+
+    if ((encoder = FLAC__stream_encoder_new()) == NULL) {
+        g_warning("FLAC__stream_encoder_new() failed");
+        goto cleanup;
+    }
+
+    FLAC__stream_encoder_set_channels(encoder, si->channels);
+    FLAC__stream_encoder_set_bits_per_sample(encoder, flac->flac_bits_per_sample);
+    FLAC__stream_encoder_set_sample_rate(encoder, si->samplesPerSec);
+    FLAC__stream_encoder_set_compression_level(encoder, 5);
+    FLAC__stream_encoder_set_total_samples_estimate(encoder, total_frames);
+
+    /* placeholder seek points, filled in by the encoder when finishing the file */
+    if ((seek_table = FLAC__metadata_object_new(FLAC__METADATA_TYPE_SEEKTABLE)) != NULL &&
+            FLAC__metadata_object_seektable_template_append_spaced_points_by_samples(seek_table,
+                si->samplesPerSec * FLAC_SEEK_POINT_INTERVAL, total_frames) &&
+            FLAC__metadata_object_seektable_template_sort(seek_table, TRUE)) {
+        FLAC__stream_encoder_set_metadata(encoder, &seek_table, 1);
+    }
+
+    FLAC__StreamEncoderInitStatus status = FLAC__stream_encoder_init_file(encoder, output_filename, NULL, NULL);
+    if (status != FLAC__STREAM_ENCODER_INIT_STATUS_OK) {
+        g_warning("Could not open %s for writing: %s", output_filename, FLAC__StreamEncoderInitStatusString[status]);
+        goto cleanup;
+    }
+
+    buf = g_malloc((size_t)FLAC_WRITE_CHUNK_FRAMES * si->blockAlign);
+    samples = g_new(FLAC__int32, (size_t)FLAC_WRITE_CHUNK_FRAMES * si->channels);
+    planes = g_new(FLAC__int32 *, si->channels);
+    for (unsigned int ch = 0; ch < si->channels; ++ch) {
+        planes[ch] = samples + (size_t)ch * FLAC_WRITE_CHUNK_FRAMES;
+    }
+
+    uint64_t frames_done = 0;
+    unsigned long pos = start_pos;
+    unsigned int shift = 32 - flac->flac_bits_per_sample;
+
+    while (frames_done < total_frames) {
+        size_t num_frames = MIN(total_frames - frames_done, FLAC_WRITE_CHUNK_FRAMES);
+
+        long ret = flac_decoder_read_samples(&dec->hdr, buf, num_frames * si->blockAlign, pos);
+        if (ret <= 0) {
+            g_warning("Could not decode samples from %s", self->filename);
+            goto cleanup;
+        }
+
+        num_frames = ret / si->blockAlign;
+
+        /* back from MSB-aligned to the original sample values */
+        converter->to_s32(buf, (int32_t *const *)planes, num_frames, si->channels);
+        for (unsigned int ch = 0; ch < si->channels; ++ch) {
+            for (size_t i = 0; i < num_frames; ++i) {
+                planes[ch][i] >>= shift;
+            }
+        }
+
+        if (!FLAC__stream_encoder_process(encoder, (const FLAC__int32 *const *)planes, num_frames)) {
+            g_warning("Error encoding FLAC data: %s",
+                    FLAC__StreamEncoderStateString[FLAC__stream_encoder_get_state(encoder)]);
+            goto cleanup;
+        }
+
+        frames_done += num_frames;
+        pos += num_frames * si->blockAlign;
+
+        report_progress((double)frames_done / total_frames, report_progress_user_data);
+    }
+
+    if (FLAC__stream_encoder_finish(encoder)) {
+        result = 0;
+    } else {
+        g_warning("Error finishing FLAC file %s", output_filename);
+    }
+
+cleanup:
+    if (encoder != NULL) {
+        if (result != 0) {
+            FLAC__stream_encoder_finish(encoder);
+        }
+        FLAC__stream_encoder_delete(encoder);
+    }
+
+    if (seek_table != NULL) {
+        FLAC__metadata_object_delete(seek_table);
+    }
+
+    if (dec != NULL) {
+        flac_close_decoder(&dec->hdr);
+    }
+
+    g_free(planes);
+    g_free(samples);
+    g_free(buf);
+
+    if (result == 0) {
+        report_progress(1.0, report_progress_user_data);
+    }
+
+    return result;
+}
+
+static void
+flac_close_file(const FormatModule *self, OpenedAudioFile *file)
+{
+    OpenedFlacFile *flac = (OpenedFlacFile *)file;
+
+    opened_audio_file_close(&flac->hdr);
+
+    if (flac->decoder != NULL) {
+        flac_close_decoder(&g_steal_pointer(&flac->decoder)->hdr);
+    }
+    g_mutex_clear(&flac->decoder_mutex);
+
+    g_free(flac);
+}
+
+static int
+flac_probe(const FormatModule *self, const char *filename, const unsigned char *head, size_t head_size)
+{
+    if (head_size >= 4 && memcmp(head, "fLaC", 4) == 0) {
+        return FORMAT_PROBE_SCORE_MAX;
+    }
+
+    /* libFLAC skips over ID3v2 tags at the start of the file */
+    if (format_module_filename_extension_check(self, filename, NULL)) {
+        return FORMAT_PROBE_SCORE_EXTENSION;
+    }
+
+    return FORMAT_PROBE_SCORE_NONE;
+}
+
+static OpenedAudioFile *
+flac_open_file(const FormatModule *self, const char *filename, char **error_message)
+{
+    OpenedFlacFile *flac = g_new0(OpenedFlacFile, 1);
+
+    if (!format_module_open_file(self, &flac->hdr, filename, error_message)) {
+        g_free(flac);
+        return NULL;
+    }
+
+    SampleInfo *si = &flac->hdr.sample_info;
+
+    g_mutex_init(&flac->decoder_mutex);
+
+    g_debug("Trying as FLAC...");
+
+    if ((flac->decoder = flac_decoder_new(&flac->hdr, error_message)) == NULL) {
+        goto error;
+    }
+
+    const FLAC__StreamMetadata_StreamInfo *info = &flac->decoder->stream_info;
+
+    g_debug("FLAC info: channels=%u, rate=%u, bits=%u, samples=%" G_GUINT64_FORMAT ", seek points=%u",
+            info->channels, info->sample_rate, info->bits_per_sample, (guint64)info->total_samples,
+            flac->decoder->seek_points);
+
+    if (info->total_samples == 0) {
+        format_module_set_error_message(error_message, "%s", "FLAC files with unknown length are not supported");
+        goto error;
+    }
+
+    flac->flac_bits_per_sample = info->bits_per_sample;
+
+    si->channels = info->channels;
+    si->samplesPerSec = info->sample_rate;
+    /* samples are returned with the bit depth rounded up to whole bytes */
+    si->bitsPerSample = (info->bits_per_sample + 7) / 8 * 8;
+
+    si->blockAlign = si->channels * (si->bitsPerSample / 8);
+    si->avgBytesPerSec = si->blockAlign * si->samplesPerSec;
+    si->blockSize = si->avgBytesPerSec / CD_BLOCKS_PER_SEC;
+
+    if (info->total_samples > G_MAXULONG / si->blockAlign) {
+        format_module_set_error_message(error_message, "%s", "FLAC file is too large for this platform");
+        goto error;
+    }
+
+    si->numBytes = info->total_samples * si->blockAlign;
+
+    if (flac->decoder->seek_points > 0) {
+        flac->hdr.details = g_strdup_printf("%u bit, %u seek points", info->bits_per_sample, flac->decoder->seek_points);
+    } else {
+        flac->hdr.details = g_strdup_printf("%u bit, no seek table", info->bits_per_sample);
+    }
+
+    return &flac->hdr;
+
+error:
+    flac_close_file(self, &flac->hdr);
+
+    return NULL;
+}
+
+static const FormatModule
+FLAC_FORMAT_MODULE = {
+    .name = "FLAC",
+    .library_name = "libFLAC",
+    .default_file_extension = ".flac",
+
+    .probe = flac_probe,
+    .open_file = flac_open_file,
+    .close_file = flac_close_file,
+
+    .read_samples = flac_read_samples,
+    .open_decoder = flac_open_decoder,
+    .decoder_read_samples = flac_decoder_read_samples,
+    .close_decoder = flac_close_decoder,
+    .parallel_decode = TRUE,
+    .write_file = flac_write_file,
+};
+
+const FormatModule *
+format_module_flac(void)
+{
+    return &FLAC_FORMAT_MODULE;
+}
+
+#else
+
+const FormatModule *
+format_module_flac(void)
+{
+    return NULL;
+}
+
+#endif /* HAVE_FLAC */
@@ -26,37 +26,96 @@
 //#define WAVBREAKER_MP3_DEBUG
 
 #include <stdint.h>
+#include <string.h>
 #include <mpg123.h>
 
+#include "io_engine.h"
+#include "seek_cache.h"
+
+/**
+ * Number of frames decoded (and discarded) before the target frame after
+ * seeking, to fill the Layer III bit reservoir and the synthesis filter
+ * state, so that decoding from any position gives the same samples as
+ * decoding the whole file from the start.
+ **/
+#define MP3_SEEK_PREFRAMES 4
+
+typedef struct MP3Frame_ MP3Frame;
+struct MP3Frame_ {
+    uint64_t offset;
+    uint32_t size;
+    uint32_t samples;
+    uint64_t sample_position;
+};
+
+/* Seek cache entry: exact length and the mpg123 seek index (fill offsets follow) */
+typedef struct MP3SeekIndex_ MP3SeekIndex;
+struct MP3SeekIndex_ {
+    int64_t length;
+    int64_t step;
+    uint64_t fill;
+    int64_t offsets[];
+};
+
+#define MP3_SEEK_CACHE_INDEX "mp3index"
+#define MP3_SEEK_CACHE_FRAMES "mp3frames"
+
+typedef struct MP3Decoder_ MP3Decoder;
+struct MP3Decoder_ {
+    FormatDecoder hdr;
+
+    mpg123_handle *mpg123;
+    size_t mpg123_offset;
+};
+
 typedef struct OpenedMP3File_ OpenedMP3File;
 struct OpenedMP3File_ {
     OpenedAudioFile hdr;
 
-    mpg123_handle *mpg123;
-    size_t mpg123_offset;
+    /* decoder used by mp3_read_samples(), and the lock for it */
+    MP3Decoder *decoder;
+    GMutex decoder_mutex;
+
+    /* held by the opener and by the scan thread that determines the exact length */
+    gint ref_count;
+
+    /* array of MP3Frame for lossless cutting, built on first use */
+    GArray *frame_index;
+    GMutex frame_index_mutex;
 };
 
 static long
-mp3_read_samples(OpenedAudioFile *self, unsigned char *buf, size_t buf_size, unsigned long start_pos)
+mp3_decoder_read_samples(FormatDecoder *decoder, unsigned char *buf, size_t buf_size, unsigned long start_pos)
 {
-    OpenedMP3File *mp3 = (OpenedMP3File *)self;
+    MP3Decoder *dec = (MP3Decoder *)decoder;
 
     size_t result;
     gboolean retried = FALSE;
 
-    if (mp3->mpg123_offset != start_pos) {
+    if (dec->mpg123_offset != start_pos) {
 retry:
-        mpg123_seek(mp3->mpg123, start_pos / mp3->hdr.sample_info.blockAlign, SEEK_SET);
-        mp3->mpg123_offset = start_pos;
+        if (mpg123_seek(dec->mpg123, start_pos / dec->hdr.file->sample_info.blockAlign, SEEK_SET) < 0) {
+            g_warning("MP3 seek failed: %s", mpg123_strerror(dec->mpg123));
+            dec->mpg123_offset = (size_t)-1;
+            return -1;
+        }
+        dec->mpg123_offset = start_pos;
     }
 
-    if (mpg123_read(mp3->mpg123, buf, buf_size, &result) == MPG123_OK) {
-        mp3->mpg123_offset += result;
+    int err;
+    do {
+        /* the output format is fixed by mp3_decoder_set_format(), so the notification can be skipped */
+        err = mpg123_read(dec->mpg123, buf, buf_size, &result);
+    } while (err == MPG123_NEW_FORMAT && result == 0);
+
+    if (err == MPG123_OK || err == MPG123_DONE || err == MPG123_NEW_FORMAT) {
+        /* MPG123_DONE can still return the last (partial) chunk of samples */
+        dec->mpg123_offset += result;
         return result;
     } else {
-        g_warning("MP3 decoding failed: %s", mpg123_strerror(mp3->mpg123));
+        g_warning("MP3 decoding failed: %s", mpg123_strerror(dec->mpg123));
         if (!retried) {
-            g_message("Retrying read at %zu...", mp3->mpg123_offset);
+            g_message("Retrying read at %zu...", dec->mpg123_offset);
             retried = TRUE;
             goto retry;
         }
@@ -65,6 +124,99 @@ retry:
     return -1;
 }
 
+static long
+mp3_read_samples(OpenedAudioFile *self, unsigned char *buf, size_t buf_size, unsigned long start_pos)
+{
+    OpenedMP3File *mp3 = (OpenedMP3File *)self;
+
+    g_mutex_lock(&mp3->decoder_mutex);
+    long result = mp3_decoder_read_samples(&mp3->decoder->hdr, buf, buf_size, start_pos);
+    g_mutex_unlock(&mp3->decoder_mutex);
+
+    return result;
+}
+
+static MP3Decoder *
+mp3_decoder_new(OpenedAudioFile *file)
+{
+    MP3Decoder *dec = g_new0(MP3Decoder, 1);
+
+    dec->hdr.file = file;
+    dec->mpg123_offset = 0;
+
+    if ((dec->mpg123 = mpg123_new(NULL, NULL)) == NULL) {
+        g_free(dec);
+        return NULL;
+    }
+
+    if (mpg123_param(dec->mpg123, MPG123_PREFRAMES, MP3_SEEK_PREFRAMES, 0.0) != MPG123_OK) {
+        g_warning("Could not set MP3 seek preroll: %s", mpg123_strerror(dec->mpg123));
+    }
+
+    if (mpg123_open(dec->mpg123, file->filename) != MPG123_OK) {
+        mpg123_delete(dec->mpg123);
+        g_free(dec);
+        return NULL;
+    }
+
+    return dec;
+}
+
+static void
+mp3_close_decoder(FormatDecoder *decoder)
+{
+    MP3Decoder *dec = (MP3Decoder *)decoder;
+
+    mpg123_close(dec->mpg123);
+    mpg123_delete(dec->mpg123);
+    g_free(dec);
+}
+
+static gboolean
+mp3_decoder_set_format(MP3Decoder *dec)
+{
+    SampleInfo *si = &dec->hdr.file->sample_info;
+
+    mpg123_format_none(dec->mpg123);
+    return (mpg123_format(dec->mpg123, si->samplesPerSec,
+                          (si->channels == 1) ? MPG123_STEREO : MPG123_MONO,
+                          MPG123_ENC_SIGNED_16) == MPG123_OK);
+}
+
+static FormatDecoder *
+mp3_open_decoder(OpenedAudioFile *self)
+{
+    OpenedMP3File *mp3 = (OpenedMP3File *)self;
+
+    MP3Decoder *dec = mp3_decoder_new(self);
+    if (dec == NULL) {
+        return NULL;
+    }
+
+    /* re-use the seek index from the initial scan instead of scanning again */
+    off_t *offsets;
+    off_t step;
+    size_t fill;
+
+    g_mutex_lock(&mp3->decoder_mutex);
+    gboolean ok = (mpg123_index(mp3->decoder->mpg123, &offsets, &step, &fill) == MPG123_OK &&
+            mpg123_set_index(dec->mpg123, offsets, step, fill) == MPG123_OK);
+    g_mutex_unlock(&mp3->decoder_mutex);
+
+    /* like mp3_open_file(), query the format so that the first read returns samples */
+    long rate;
+    int channels;
+    int encoding;
+    if (!ok || !mp3_decoder_set_format(dec) ||
+            mpg123_getformat(dec->mpg123, &rate, &channels, &encoding) != MPG123_OK) {
+        g_warning("Could not set up MP3 decoder: %s", mpg123_strerror(dec->mpg123));
+        mp3_close_decoder(&dec->hdr);
+        return NULL;
+    }
+
+    return &dec->hdr;
+}
+
 static gboolean
 mp3_parse_header(uint32_t header, uint32_t *bitrate, uint32_t *frequency, uint32_t *samples, uint32_t *framesize)
 {
@@ -110,6 +262,158 @@ mp3_parse_header(uint32_t header, uint32_t *bitrate, uint32_t *frequency, uint32
     return TRUE;
 }
 
+static GArray *
+mp3_build_frame_index(OpenedMP3File *mp3)
+{
+    GArray *frames = g_array_new(FALSE, FALSE, sizeof(MP3Frame));
+    unsigned char *buf = g_malloc(IO_ENGINE_CHUNK_SIZE);
+
+    uint64_t file_size = mp3->hdr.file_size;
+    uint64_t buf_start = 0;
+    size_t buf_len = 0;
+    uint64_t file_offset = 0;
+    uint64_t last_frame_end = 0;
+    uint64_t sample_position = 0;
+
+    while (TRUE) {
+        if (file_offset + 4 > buf_start + buf_len) {
+            gssize ret = io_pread(mp3->hdr.fp, buf, IO_ENGINE_CHUNK_SIZE, file_offset);
+            if (ret < 0) {
+                g_warning("Error reading from %s", mp3->hdr.filename);
+                g_array_free(frames, TRUE);
+                frames = NULL;
+                break;
+            } else if (ret < 4) {
+                break;
+            }
+
+            buf_start = file_offset;
+            buf_len = ret;
+        }
+
+        const unsigned char *head = buf + (file_offset - buf_start);
+        uint32_t header = ((uint32_t)head[0] << 24) | ((uint32_t)head[1] << 16) | ((uint32_t)head[2] << 8) | head[3];
+
+        uint32_t bitrate = 0;
+        uint32_t frequency = 0;
+        uint32_t samples = 0;
+        uint32_t framesize = 0;
+
+        if (!mp3_parse_header(header, &bitrate, &frequency, &samples, &framesize)) {
+            file_offset++;
+            continue;
+        }
+
+        if (file_offset + framesize > file_size) {
+            g_warning("Last frame in MP3 @ 0x%08" G_GINT64_MODIFIER "x is truncated", file_offset);
+            break;
+        }
+
+        if (last_frame_end < file_offset) {
+            g_warning("Skipped non-frame data in MP3 @ 0x%08" G_GINT64_MODIFIER "x (%" G_GUINT64_FORMAT " bytes)",
+                    last_frame_end, file_offset - last_frame_end);
+        }
+
+        MP3Frame frame = { file_offset, framesize, samples, sample_position };
+        g_array_append_val(frames, frame);
+
+        sample_position += samples;
+        file_offset += framesize;
+        last_frame_end = file_offset;
+    }
+
+    g_free(buf);
+
+#if defined(WAVBREAKER_MP3_DEBUG)
+    if (frames != NULL) {
+        g_debug("Indexed %u MP3 frames in '%s'", frames->len, mp3->hdr.filename);
+    }
+#endif /* WAVBREAKER_MP3_DEBUG */
+
+    return frames;
+}
+
+static GArray *
+mp3_load_frame_index(OpenedMP3File *mp3)
+{
+    size_t size;
+    MP3Frame *cached = seek_cache_load(&mp3->hdr, MP3_SEEK_CACHE_FRAMES, &size);
+
+    if (cached == NULL) {
+        return NULL;
+    }
+
+    GArray *frames = NULL;
+    if (size % sizeof(MP3Frame) == 0) {
+        frames = g_array_sized_new(FALSE, FALSE, sizeof(MP3Frame), size / sizeof(MP3Frame));
+        g_array_append_vals(frames, cached, size / sizeof(MP3Frame));
+    }
+
+    g_free(cached);
+
+    return frames;
+}
+
+static GArray *
+mp3_get_frame_index(OpenedMP3File *mp3)
+{
+    g_mutex_lock(&mp3->frame_index_mutex);
+    if (mp3->frame_index == NULL) {
+        mp3->frame_index = mp3_load_frame_index(mp3);
+    }
+    if (mp3->frame_index == NULL) {
+        mp3->frame_index = mp3_build_frame_index(mp3);
+        if (mp3->frame_index != NULL) {
+            seek_cache_save(&mp3->hdr, MP3_SEEK_CACHE_FRAMES, mp3->frame_index->data,
+                    mp3->frame_index->len * sizeof(MP3Frame));
+        }
+    }
+    g_mutex_unlock(&mp3->frame_index_mutex);
+
+    return mp3->frame_index;
+}
+
+/* index of the first frame for which get_position(frame) >= position, or frames->len */
+static guint
+mp3_frame_index_search(GArray *frames, uint64_t position, gboolean compare_end)
+{
+    guint lo = 0;
+    guint hi = frames->len;
+
+    while (lo < hi) {
+        guint mid = lo + (hi - lo) / 2;
+        const MP3Frame *frame = &g_array_index(frames, MP3Frame, mid);
+        uint64_t frame_position = frame->sample_position + (compare_end ? frame->samples : 0);
+
+        if (frame_position < position) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+typedef struct MP3CopyProgress_ MP3CopyProgress;
+struct MP3CopyProgress_ {
+    report_progress_func report_progress;
+    void *report_progress_user_data;
+
+    uint64_t bytes_done;
+    uint64_t bytes_total;
+    uint64_t run_length;
+};
+
+static void
+mp3_copy_progress_changed(double progress, void *user_data)
+{
+    MP3CopyProgress *copy = user_data;
+
+    copy->report_progress((copy->bytes_done + progress * copy->run_length) / (double)copy->bytes_total,
+            copy->report_progress_user_data);
+}
+
 int
 mp3_write_file(OpenedAudioFile *self, const char *output_filename, unsigned long start_pos, unsigned long end_pos, report_progress_func report_progress, void *report_progress_user_data)
 {
@@ -118,109 +422,256 @@ mp3_write_file(OpenedAudioFile *self, const char *output_filename, unsigned long
     start_pos /= mp3->hdr.sample_info.blockSize;
     end_pos /= mp3->hdr.sample_info.blockSize;
 
-    uint32_t start_samples = start_pos * mp3->hdr.sample_info.samplesPerSec / CD_BLOCKS_PER_SEC;
-    uint32_t end_samples = end_pos * mp3->hdr.sample_info.samplesPerSec / CD_BLOCKS_PER_SEC;
+    uint64_t start_samples = (uint64_t)start_pos * mp3->hdr.sample_info.samplesPerSec / CD_BLOCKS_PER_SEC;
+    uint64_t end_samples = (uint64_t)end_pos * mp3->hdr.sample_info.samplesPerSec / CD_BLOCKS_PER_SEC;
 
     if (end_samples == 0) {
-        end_samples = mp3->hdr.sample_info.numBytes / mp3->hdr.sample_info.blockAlign;
+        /* until the last frame (numBytes might still be an estimate) */
+        end_samples = G_MAXUINT64;
     }
 
-    FILE *output_file = fopen(output_filename, "wb");
-
-    if (!output_file) {
-        g_warning("Could not open '%s' for writing", output_filename);
+    GArray *frames = mp3_get_frame_index(mp3);
+    if (frames == NULL) {
         return -1;
     }
 
-    fseek(mp3->hdr.fp, 0, SEEK_SET);
+    /* from the first frame starting at or after start_samples to the first frame reaching end_samples */
+    guint first = mp3_frame_index_search(frames, start_samples, FALSE);
+    guint last = mp3_frame_index_search(frames, end_samples, TRUE);
 
-    report_progress(0.0, report_progress_user_data);
+    if (last < first) {
+        last = first;
+    }
+    if (last >= frames->len) {
+        last = frames->len - 1;
+    }
 
-    uint32_t header = 0x00000000;
-    uint32_t sample_position = 0;
-    uint32_t file_offset = 0;
-    uint32_t last_frame_end = 0;
-    uint32_t frames_written = 0;
+    MP3CopyProgress copy = { report_progress, report_progress_user_data, 0, 0, 0 };
+    guint frames_written = 0;
+    int result = 0;
 
-    while (!feof(mp3->hdr.fp)) {
-        fseek(mp3->hdr.fp, file_offset, SEEK_SET);
+    if (first < frames->len) {
+        const MP3Frame *first_frame = &g_array_index(frames, MP3Frame, first);
+        const MP3Frame *last_frame = &g_array_index(frames, MP3Frame, last);
 
-        int a = fgetc(mp3->hdr.fp);
-        if (a == EOF) {
-            break;
-        }
-
-        header = ((header & 0xffffff) << 8) | (a & 0xff);
+        copy.bytes_total = last_frame->offset + last_frame->size - first_frame->offset;
+    }
 
-        uint32_t bitrate = 0;
-        uint32_t frequency = 0;
-        uint32_t samples = 0;
-        uint32_t framesize = 0;
+    IoOutputFile *output = io_output_open(output_filename, copy.bytes_total);
 
-        if (mp3_parse_header(header, &bitrate, &frequency, &samples, &framesize)) {
-            uint32_t frame_start = file_offset - 3;
+    if (!output) {
+        g_warning("Could not open '%s' for writing", output_filename);
+        return -1;
+    }
 
-            if (last_frame_end < frame_start) {
-                g_warning("Skipped non-frame data in MP3 @ 0x%08x (%d bytes)",
-                        last_frame_end, frame_start - last_frame_end);
-            }
+    report_progress(0.0, report_progress_user_data);
 
-            if (start_samples <= sample_position) {
-                // Write this frame to the output file
-                char *buf = malloc(framesize);
-                fseek(mp3->hdr.fp, frame_start, SEEK_SET);
-                if (fread(buf, 1, framesize, mp3->hdr.fp) != framesize) {
-                    g_warning("Tried to read over the end of the input file");
-                    break;
-                }
-                if (fwrite(buf, 1, framesize, output_file) != framesize) {
-                    g_warning("Failed to write %d bytes to output file", framesize);
-                    break;
-                }
-                free(buf);
-
-                frames_written++;
-
-                report_progress((double)(sample_position - start_samples) / (double)(end_samples - start_samples), report_progress_user_data);
-
-                if (end_samples <= sample_position + samples) {
-                    // Done writing this part
-                    break;
-                }
-            }
+    /* runs of adjacent frames are copied in one go, skipping non-frame data in between */
+    guint i = first;
+    while (first < frames->len && i <= last) {
+        const MP3Frame *run_start = &g_array_index(frames, MP3Frame, i);
+        uint64_t run_end = run_start->offset + run_start->size;
 
-            sample_position += samples;
+        guint j = i + 1;
+        while (j <= last && g_array_index(frames, MP3Frame, j).offset == run_end) {
+            run_end += g_array_index(frames, MP3Frame, j).size;
+            j++;
+        }
 
-            file_offset = frame_start + framesize;
-            last_frame_end = file_offset;
+        copy.run_length = run_end - run_start->offset;
 
-            header = 0x00000000;
-        } else {
-            file_offset++;
+        if (io_copy(mp3->hdr.fp, run_start->offset, io_output_get_fp(output), copy.bytes_done, copy.run_length,
+                    mp3_copy_progress_changed, &copy) != (int64_t)copy.run_length) {
+            g_warning("Failed to copy %" G_GUINT64_FORMAT " bytes to output file", copy.run_length);
+            result = -1;
+            break;
         }
+
+        copy.bytes_done += copy.run_length;
+        frames_written += j - i;
+        i = j;
     }
 
     report_progress(1.0, report_progress_user_data);
 
 #if defined(WAVBREAKER_MP3_DEBUG)
-    g_debug("Wrote %d MP3 frames from '%s' to '%s'", frames_written, sample_file, output_filename);
+    g_debug("Wrote %u MP3 frames from '%s' to '%s'", frames_written, mp3->hdr.filename, output_filename);
+#else
+    (void)frames_written;
 #endif /* WAVBREAKER_MP3_DEBUG */
 
-    fclose(output_file);
+    if (!io_output_close(output)) {
+        g_warning("Failed to write to '%s'", output_filename);
+        result = -1;
+    }
 
-    return 0;
+    return result;
 }
 
 static void
-mp3_close_file(const FormatModule *self, OpenedAudioFile *file)
+mp3_file_unref(OpenedMP3File *mp3)
 {
-    OpenedMP3File *mp3 = (OpenedMP3File *)file;
+    if (!g_atomic_int_dec_and_test(&mp3->ref_count)) {
+        return;
+    }
 
     opened_audio_file_close(&mp3->hdr);
-    mpg123_close(g_steal_pointer(&mp3->mpg123));
+    if (mp3->decoder != NULL) {
+        mp3_close_decoder(&g_steal_pointer(&mp3->decoder)->hdr);
+    }
+    g_mutex_clear(&mp3->decoder_mutex);
+    if (mp3->frame_index != NULL) {
+        g_array_free(g_steal_pointer(&mp3->frame_index), TRUE);
+    }
+    g_mutex_clear(&mp3->frame_index_mutex);
     g_free(mp3);
 }
 
+static void
+mp3_close_file(const FormatModule *self, OpenedAudioFile *file)
+{
+    OpenedMP3File *mp3 = (OpenedMP3File *)file;
+
+    /* the scan thread might still be running, in which case it frees the file */
+    mp3_file_unref(mp3);
+}
+
+static gboolean
+mp3_is_frame_header(const unsigned char *head, size_t head_size)
+{
+    if (head_size < 4) {
+        return FALSE;
+    }
+
+    unsigned char version = (head[1] >> 3) & 0x03;
+    unsigned char layer = (head[1] >> 1) & 0x03;
+    unsigned char bitrate_index = (head[2] >> 4) & 0x0f;
+    unsigned char sampling_rate_index = (head[2] >> 2) & 0x03;
+
+    return (head[0] == 0xff && (head[1] & 0xe0) == 0xe0 &&
+            version != 0x01 && layer != 0x00 &&
+            bitrate_index != 0x0f && sampling_rate_index != 0x03);
+}
+
+static int
+mp3_probe(const FormatModule *self, const char *filename, const unsigned char *head, size_t head_size)
+{
+    /* see mp3_open_file() */
+    if (!format_module_filename_extension_check(self, filename, NULL) &&
+            !format_module_filename_extension_check(self, filename, ".mp2")) {
+        return FORMAT_PROBE_SCORE_NONE;
+    }
+
+    if ((head_size >= 3 && memcmp(head, "ID3", 3) == 0) || mp3_is_frame_header(head, head_size)) {
+        return FORMAT_PROBE_SCORE_MAX;
+    }
+
+    /* mpg123 can skip over junk at the start of the file */
+    return FORMAT_PROBE_SCORE_EXTENSION;
+}
+
+static void
+mp3_save_seek_index(OpenedMP3File *mp3, off_t length, const off_t *offsets, off_t step, size_t fill)
+{
+    size_t size = sizeof(MP3SeekIndex) + fill * sizeof(int64_t);
+    MP3SeekIndex *index = g_malloc(size);
+
+    index->length = length;
+    index->step = step;
+    index->fill = fill;
+    for (size_t i = 0; i < fill; ++i) {
+        index->offsets[i] = offsets[i];
+    }
+
+    seek_cache_save(&mp3->hdr, MP3_SEEK_CACHE_INDEX, index, size);
+
+    g_free(index);
+}
+
+/* Sets the exact length and the seek index of the main decoder from the cache */
+static gboolean
+mp3_load_seek_index(OpenedMP3File *mp3)
+{
+    size_t size;
+    MP3SeekIndex *index = seek_cache_load(&mp3->hdr, MP3_SEEK_CACHE_INDEX, &size);
+
+    if (index == NULL) {
+        return FALSE;
+    }
+
+    gboolean result = FALSE;
+
+    if (size >= sizeof(MP3SeekIndex) && index->length >= 0 &&
+            index->fill == (size - sizeof(MP3SeekIndex)) / sizeof(int64_t)) {
+        off_t *offsets = g_new(off_t, index->fill);
+        for (size_t i = 0; i < index->fill; ++i) {
+            offsets[i] = index->offsets[i];
+        }
+
+        if (mpg123_set_index(mp3->decoder->mpg123, offsets, index->step, index->fill) == MPG123_OK) {
+            mp3->hdr.sample_info.numBytes = index->length * mp3->hdr.sample_info.blockAlign;
+            result = TRUE;
+        }
+
+        g_free(offsets);
+    }
+
+    g_free(index);
+
+    return result;
+}
+
+static gpointer
+mp3_scan_thread(gpointer user_data)
+{
+    OpenedMP3File *mp3 = user_data;
+    unsigned long num_bytes = mp3->hdr.sample_info.numBytes;
+
+    g_debug("Scanning MP3 file...");
+
+    MP3Decoder *scanner = mp3_decoder_new(&mp3->hdr);
+    if (scanner != NULL && mpg123_scan(scanner->mpg123) == MPG123_OK) {
+        off_t length = mpg123_length(scanner->mpg123);
+        if (length >= 0) {
+            num_bytes = length * mp3->hdr.sample_info.blockAlign;
+        }
+
+        /* the main decoder (and decoders opened later) can now seek using the full index */
+        off_t *offsets;
+        off_t step;
+        size_t fill;
+
+        if (mpg123_index(scanner->mpg123, &offsets, &step, &fill) == MPG123_OK) {
+            g_mutex_lock(&mp3->decoder_mutex);
+            if (mpg123_set_index(mp3->decoder->mpg123, offsets, step, fill) != MPG123_OK) {
+                g_warning("Could not set MP3 seek index: %s", mpg123_strerror(mp3->decoder->mpg123));
+            }
+            g_mutex_unlock(&mp3->decoder_mutex);
+
+            /* so that the next time this file is opened, no scan is needed */
+            if (length >= 0) {
+                mp3_save_seek_index(mp3, length, offsets, step, fill);
+            }
+        } else {
+            g_warning("Could not get MP3 seek index: %s", mpg123_strerror(scanner->mpg123));
+        }
+    } else {
+        g_warning("Failed to scan MP3, using the estimated length");
+    }
+
+    if (scanner != NULL) {
+        mp3_close_decoder(&scanner->hdr);
+    }
+
+    g_debug("Exact MP3 decoded size: %lu (estimated: %lu)", num_bytes, mp3->hdr.sample_info.numBytes);
+
+    format_module_set_exact_num_bytes(&mp3->hdr, num_bytes);
+
+    mp3_file_unref(mp3);
+
+    return NULL;
+}
+
 static OpenedAudioFile *
 mp3_open_file(const FormatModule *self, const char *filename, char **error_message)
 {
@@ -233,6 +684,8 @@ mp3_open_file(const FormatModule *self, const char *filename, char **error_messa
 
     OpenedMP3File *mp3 = g_new0(OpenedMP3File, 1);
 
+    mp3->ref_count = 1;
+
     if (!format_module_open_file(self, &mp3->hdr, filename, error_message)) {
         g_free(mp3);
         return NULL;
@@ -240,34 +693,26 @@ mp3_open_file(const FormatModule *self, const char *filename, char **error_messa
 
     SampleInfo *si = &mp3->hdr.sample_info;
 
-    mp3->mpg123_offset = 0;
-
-    if ((mp3->mpg123 = mpg123_new(NULL, NULL)) == NULL) {
-        format_module_set_error_message(error_message, "Failed to create MP3 decoder");
-        goto error;
-    }
+    g_mutex_init(&mp3->decoder_mutex);
+    g_mutex_init(&mp3->frame_index_mutex);
 
-    if (mpg123_open(mp3->mpg123, mp3->hdr.filename) == MPG123_OK) {
+    if ((mp3->decoder = mp3_decoder_new(&mp3->hdr)) != NULL) {
         g_debug("Detected MP3 format");
 
+        mpg123_handle *mpg123 = mp3->decoder->mpg123;
+
         long rate;
         int channels;
         int encoding;
-        if (mpg123_getformat(mp3->mpg123, &rate, &channels, &encoding) != MPG123_OK ) {
+        if (mpg123_getformat(mpg123, &rate, &channels, &encoding) != MPG123_OK ) {
             format_module_set_error_message(error_message, "Could not get MP3 file format");
             goto error;
         }
 
-        g_debug("Scanning MP3 file...");
-        if (mpg123_scan(mp3->mpg123) != MPG123_OK) {
-            format_module_set_error_message(error_message, "Failed to scan MP3");
-            goto error;
-        }
-
         struct mpg123_frameinfo fi;
         memset(&fi, 0, sizeof(fi));
 
-        if (mpg123_info(mp3->mpg123, &fi) == MPG123_OK) {
+        if (mpg123_info(mpg123, &fi) == MPG123_OK) {
             si->channels = (fi.mode == MPG123_M_MONO) ? 1 : 2;
             si->samplesPerSec = fi.rate;
             si->bitsPerSample = 16;
@@ -275,8 +720,10 @@ mp3_open_file(const FormatModule *self, const char *filename, char **error_messa
             si->blockAlign = si->channels * (si->bitsPerSample / 8);
             si->avgBytesPerSec = si->blockAlign * si->samplesPerSec;
             si->blockSize = si->avgBytesPerSec / CD_BLOCKS_PER_SEC;
-            si->numBytes = mpg123_length(mp3->mpg123) * si->blockAlign;
-            g_debug("Channels: %d, rate: %d, bits: %d, decoded size: %lu",
+            /* from the Xing/Info/VBRI header if there is one, otherwise from the bitrate */
+            off_t length = mpg123_length(mpg123);
+            si->numBytes = (length >= 0) ? length * si->blockAlign : 0;
+            g_debug("Channels: %d, rate: %d, bits: %d, estimated decoded size: %lu",
                     si->channels, si->samplesPerSec,
                     si->bitsPerSample, si->numBytes);
 
@@ -305,19 +752,26 @@ mp3_open_file(const FormatModule *self, const char *filename, char **error_messa
 
             mp3->hdr.details = g_strdup_printf("MPEG-%s Layer %s, %s, %d kbps", mpeg_version, layer, mode, fi.bitrate);
 
-            mpg123_format_none(mp3->mpg123);
-            if (mpg123_format(mp3->mpg123, si->samplesPerSec,
-                              (si->channels == 1) ? MPG123_STEREO : MPG123_MONO,
-                              MPG123_ENC_SIGNED_16) != MPG123_OK) {
+            if (!mp3_decoder_set_format(mp3->decoder)) {
                 format_module_set_error_message(error_message, "Failed to set mpg123 format");
                 goto error;
             }
         }
     } else {
-        format_module_set_error_message(error_message, "mpg123_open() failed");
+        format_module_set_error_message(error_message, "Could not open MP3 decoder");
         goto error;
     }
 
+    if (mp3_load_seek_index(mp3)) {
+        g_debug("Using cached MP3 seek index, decoded size: %lu", si->numBytes);
+        return &mp3->hdr;
+    }
+
+    /* a full scan reads the whole file, so don't wait for it */
+    format_module_set_info_estimated(&mp3->hdr);
+    g_atomic_int_inc(&mp3->ref_count);
+    g_thread_unref(g_thread_new("mp3 scan", mp3_scan_thread, mp3));
+
     return &mp3->hdr;
 
 error:
@@ -332,10 +786,15 @@ MP3_FORMAT_MODULE = {
     .library_name = "libmpg123",
     .default_file_extension = ".mp3",
 
+    .probe = mp3_probe,
     .open_file = mp3_open_file,
     .close_file = mp3_close_file,
 
     .read_samples = mp3_read_samples,
+    .open_decoder = mp3_open_decoder,
+    .decoder_read_samples = mp3_decoder_read_samples,
+    .close_decoder = mp3_close_decoder,
+    .parallel_decode = TRUE,
     .write_file = mp3_write_file,
 };
 
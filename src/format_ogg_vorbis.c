@@ -22,51 +22,417 @@
 
 #if defined(HAVE_VORBISFILE)
 
+#include <ogg/ogg.h>
 #include <vorbis/codec.h>
 #include <vorbis/vorbisfile.h>
 
 #include <stdint.h>
+#include <string.h>
 #include <inttypes.h>
 
+#include "io_engine.h"
+#include "seek_cache.h"
+
+/* Page header: "OggS", version, header type, granule position, serial, sequence, CRC, segment count */
+#define OGG_PAGE_HEADER_SIZE 27
+#define OGG_PAGE_MAX_SIZE (OGG_PAGE_HEADER_SIZE + 255 + 255 * 255)
+
+#define OGG_PAGE_CONTINUED 0x01
+#define OGG_PAGE_BOS 0x02
+#define OGG_PAGE_EOS 0x04
+
+/* identification, comment and setup header; audio data starts on a new page */
+#define VORBIS_HEADER_PACKETS 3
+
+#define OGG_VORBIS_SEEK_CACHE_PAGES "oggpages"
+
+typedef struct OggVorbisPage_ OggVorbisPage;
+struct OggVorbisPage_ {
+    uint64_t offset;
+    uint32_t size;
+    /* number of packets that end on this page */
+    uint16_t packets;
+    uint8_t header_type;
+    uint8_t reserved;
+    /* -1 if no packet ends on this page */
+    int64_t granulepos;
+};
+
+typedef struct OggVorbisDecoder_ OggVorbisDecoder;
+struct OggVorbisDecoder_ {
+    FormatDecoder hdr;
+
+    OggVorbis_File ogg_vorbis_file;
+    size_t ogg_vorbis_offset;
+};
 
 typedef struct OpenedOGGVorbisFile_ OpenedOGGVorbisFile;
 struct OpenedOGGVorbisFile_ {
     OpenedAudioFile hdr;
 
-    OggVorbis_File ogg_vorbis_file;
-    size_t ogg_vorbis_offset;
+    /* decoder used by ogg_vorbis_read_samples(), and the lock for it */
+    OggVorbisDecoder *decoder;
+    GMutex decoder_mutex;
+
+    /* array of OggVorbisPage (first logical stream only) for lossless cutting, built on first use */
+    GArray *page_index;
+    GMutex page_index_mutex;
+
+    /* set if several streams follow each other in the file, those can't be split */
+    gboolean chained;
 };
 
 static long
-ogg_vorbis_read_samples(OpenedAudioFile *self, unsigned char *buf, size_t buf_size, unsigned long start_pos)
+ogg_vorbis_decoder_read_samples(FormatDecoder *decoder, unsigned char *buf, size_t buf_size, unsigned long start_pos)
 {
-    OpenedOGGVorbisFile *ogg = (OpenedOGGVorbisFile *)self;
-
-    if (ogg->ogg_vorbis_offset != start_pos) {
-        ov_pcm_seek(&ogg->ogg_vorbis_file, start_pos / ogg->hdr.sample_info.blockAlign);
-        ogg->ogg_vorbis_offset = start_pos;
+    OggVorbisDecoder *dec = (OggVorbisDecoder *)decoder;
+    SampleInfo *si = &dec->hdr.file->sample_info;
+
+    if (dec->ogg_vorbis_offset != start_pos) {
+        /* sample-accurate, so independent decoders can each decode their own range */
+        int res = ov_pcm_seek(&dec->ogg_vorbis_file, start_pos / si->blockAlign);
+        if (res != 0) {
+            g_warning("Error in ov_pcm_seek(): %d", res);
+            dec->ogg_vorbis_offset = (size_t)-1;
+            return -1;
+        }
+        dec->ogg_vorbis_offset = start_pos;
     }
 
     long result = 0;
 
-    while (buf_size > 0) {
-        long res = ov_read(&ogg->ogg_vorbis_file, (char *)buf, buf_size, 0, 2, 1, NULL);
-        if (res < 0) {
-            g_warning("Error in ov_read(): %ld", res);
+    while (buf_size >= si->blockAlign) {
+        float **pcm;
+        long frames = ov_read_float(&dec->ogg_vorbis_file, &pcm, buf_size / si->blockAlign, NULL);
+        if (frames < 0) {
+            g_warning("Error in ov_read_float(): %ld", frames);
             return -1;
         }
 
+        if (frames == 0) {
+            break;
+        }
+
+        /* planar native floats to interleaved 32-bit float little-endian */
+        for (long i = 0; i < frames; ++i) {
+            for (int ch = 0; ch < si->channels; ++ch) {
+                uint32_t value;
+                memcpy(&value, &pcm[ch][i], sizeof(value));
+
+                for (int b = 0; b < 4; ++b) {
+                    *buf++ = (value >> (8 * b)) & 0xFF;
+                }
+            }
+        }
+
+        long res = frames * si->blockAlign;
         result += res;
-        ogg->ogg_vorbis_offset += res;
-        buf += res;
+        dec->ogg_vorbis_offset += res;
         buf_size -= res;
+    }
+
+    return result;
+}
+
+static long
+ogg_vorbis_read_samples(OpenedAudioFile *self, unsigned char *buf, size_t buf_size, unsigned long start_pos)
+{
+    OpenedOGGVorbisFile *ogg = (OpenedOGGVorbisFile *)self;
+
+    g_mutex_lock(&ogg->decoder_mutex);
+    long result = ogg_vorbis_decoder_read_samples(&ogg->decoder->hdr, buf, buf_size, start_pos);
+    g_mutex_unlock(&ogg->decoder_mutex);
+
+    return result;
+}
+
+static OggVorbisDecoder *
+ogg_vorbis_decoder_new(OpenedAudioFile *file, int *ogg_res)
+{
+    OggVorbisDecoder *dec = g_new0(OggVorbisDecoder, 1);
+
+    dec->hdr.file = file;
+    dec->ogg_vorbis_offset = 0;
+
+    *ogg_res = ov_fopen(file->filename, &dec->ogg_vorbis_file);
+    if (*ogg_res != 0) {
+        g_free(dec);
+        return NULL;
+    }
+
+    return dec;
+}
 
-        if (res == 0) {
+static void
+ogg_vorbis_close_decoder(FormatDecoder *decoder)
+{
+    OggVorbisDecoder *dec = (OggVorbisDecoder *)decoder;
+
+    ov_clear(&dec->ogg_vorbis_file);
+    g_free(dec);
+}
+
+static FormatDecoder *
+ogg_vorbis_open_decoder(OpenedAudioFile *self)
+{
+    int ogg_res;
+    OggVorbisDecoder *dec = ogg_vorbis_decoder_new(self, &ogg_res);
+
+    if (dec == NULL) {
+        g_warning("Could not set up Ogg Vorbis decoder: ov_fopen() returned %d", ogg_res);
+        return NULL;
+    }
+
+    return &dec->hdr;
+}
+
+static uint32_t
+ogg_read_u32le(const unsigned char *buf)
+{
+    return (uint32_t)buf[0] | ((uint32_t)buf[1] << 8) | ((uint32_t)buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
+
+static void
+ogg_write_u32le(unsigned char *buf, uint32_t value)
+{
+    for (int i = 0; i < 4; ++i) {
+        buf[i] = (value >> (8 * i)) & 0xFF;
+    }
+}
+
+static GArray *
+ogg_vorbis_build_page_index(OpenedOGGVorbisFile *ogg)
+{
+    GArray *pages = g_array_new(FALSE, FALSE, sizeof(OggVorbisPage));
+    unsigned char *buf = g_malloc(IO_ENGINE_CHUNK_SIZE);
+
+    uint64_t file_size = ogg->hdr.file_size;
+    uint64_t buf_start = 0;
+    size_t buf_len = 0;
+    uint64_t file_offset = 0;
+    uint64_t last_page_end = 0;
+    gboolean have_serial = FALSE;
+    uint32_t serial = 0;
+
+    while (TRUE) {
+        /* the page header including the segment table is at most OGG_PAGE_HEADER_SIZE + 255 bytes */
+        if (file_offset + OGG_PAGE_HEADER_SIZE + 255 > buf_start + buf_len &&
+                buf_start + buf_len < file_size) {
+            gssize ret = io_pread(ogg->hdr.fp, buf, IO_ENGINE_CHUNK_SIZE, file_offset);
+            if (ret < 0) {
+                g_warning("Error reading from %s", ogg->hdr.filename);
+                g_array_free(pages, TRUE);
+                pages = NULL;
+                break;
+            }
+
+            buf_start = file_offset;
+            buf_len = ret;
+        }
+
+        size_t avail = buf_start + buf_len - file_offset;
+        const unsigned char *head = buf + (file_offset - buf_start);
+
+        if (avail < OGG_PAGE_HEADER_SIZE) {
+            break;
+        }
+
+        if (memcmp(head, "OggS", 4) != 0 || head[4] != 0 /* version */) {
+            file_offset++;
+            continue;
+        }
+
+        size_t header_size = OGG_PAGE_HEADER_SIZE + head[26];
+        if (avail < header_size) {
+            break;
+        }
+
+        OggVorbisPage page = { file_offset, header_size, 0, head[5], 0, 0 };
+        for (size_t i = OGG_PAGE_HEADER_SIZE; i < header_size; ++i) {
+            page.size += head[i];
+            if (head[i] < 255) {
+                page.packets++;
+            }
+        }
+
+        uint64_t granulepos = ogg_read_u32le(head + 6) | ((uint64_t)ogg_read_u32le(head + 10) << 32);
+        page.granulepos = (int64_t)granulepos;
+
+        if (file_offset + page.size > file_size) {
+            g_warning("Last page in Ogg file @ 0x%08" G_GINT64_MODIFIER "x is truncated", file_offset);
             break;
         }
+
+        if (last_page_end < file_offset) {
+            g_warning("Skipped non-page data in Ogg file @ 0x%08" G_GINT64_MODIFIER "x (%" G_GUINT64_FORMAT " bytes)",
+                    last_page_end, file_offset - last_page_end);
+        }
+
+        file_offset += page.size;
+        last_page_end = file_offset;
+
+        uint32_t page_serial = ogg_read_u32le(head + 14);
+        if (!have_serial) {
+            serial = page_serial;
+            have_serial = TRUE;
+        } else if (page_serial != serial) {
+            if (page.header_type & OGG_PAGE_BOS) {
+                g_warning("Ogg file '%s' is chained, only the first stream is indexed", ogg->hdr.filename);
+                break;
+            }
+
+            /* page of another multiplexed stream */
+            continue;
+        }
+
+        g_array_append_val(pages, page);
     }
 
-    return result;
+    g_free(buf);
+
+    return pages;
+}
+
+static GArray *
+ogg_vorbis_load_page_index(OpenedOGGVorbisFile *ogg)
+{
+    size_t size;
+    OggVorbisPage *cached = seek_cache_load(&ogg->hdr, OGG_VORBIS_SEEK_CACHE_PAGES, &size);
+
+    if (cached == NULL) {
+        return NULL;
+    }
+
+    GArray *pages = NULL;
+    if (size % sizeof(OggVorbisPage) == 0) {
+        pages = g_array_sized_new(FALSE, FALSE, sizeof(OggVorbisPage), size / sizeof(OggVorbisPage));
+        g_array_append_vals(pages, cached, size / sizeof(OggVorbisPage));
+    }
+
+    g_free(cached);
+
+    return pages;
+}
+
+static GArray *
+ogg_vorbis_get_page_index(OpenedOGGVorbisFile *ogg)
+{
+    g_mutex_lock(&ogg->page_index_mutex);
+    if (ogg->page_index == NULL) {
+        ogg->page_index = ogg_vorbis_load_page_index(ogg);
+    }
+    if (ogg->page_index == NULL) {
+        ogg->page_index = ogg_vorbis_build_page_index(ogg);
+        if (ogg->page_index != NULL) {
+            seek_cache_save(&ogg->hdr, OGG_VORBIS_SEEK_CACHE_PAGES, ogg->page_index->data,
+                    ogg->page_index->len * sizeof(OggVorbisPage));
+        }
+    }
+    g_mutex_unlock(&ogg->page_index_mutex);
+
+    return ogg->page_index;
+}
+
+/* number of pages at the start of the stream that contain the Vorbis header packets */
+static guint
+ogg_vorbis_count_header_pages(GArray *pages)
+{
+    guint packets = 0;
+
+    for (guint i = 0; i < pages->len; ++i) {
+        packets += g_array_index(pages, OggVorbisPage, i).packets;
+        if (packets >= VORBIS_HEADER_PACKETS) {
+            return i + 1;
+        }
+    }
+
+    return pages->len;
+}
+
+/**
+ * Granule position at which a page would start if it were the first audio
+ * page of a stream: the first packet only primes the decoder, and each of
+ * the following packets completes the overlap with the previous one (a
+ * quarter of the block size of each). The page must not start with a
+ * continued packet.
+ **/
+static gboolean
+ogg_vorbis_get_page_start(OpenedOGGVorbisFile *ogg, const OggVorbisPage *page, unsigned char *buf, int64_t *page_start)
+{
+    if (io_pread(ogg->hdr.fp, buf, page->size, page->offset) != (gssize)page->size) {
+        g_warning("Could not read Ogg page @ 0x%08" G_GINT64_MODIFIER "x", page->offset);
+        return FALSE;
+    }
+
+    /* the header packets of the first stream, read by vorbisfile when opening the file */
+    vorbis_info *info = ov_info(&ogg->decoder->ogg_vorbis_file, 0);
+
+    size_t header_size = OGG_PAGE_HEADER_SIZE + buf[26];
+    size_t packet_offset = header_size;
+    size_t packet_size = 0;
+    long previous_blocksize = -1;
+    int64_t samples = 0;
+
+    for (size_t i = OGG_PAGE_HEADER_SIZE; i < header_size; ++i) {
+        packet_size += buf[i];
+        if (buf[i] == 255) {
+            /* the packet continues in the next segment */
+            continue;
+        }
+
+        if (packet_size > 0) {
+            ogg_packet packet;
+            memset(&packet, 0, sizeof(packet));
+            packet.packet = buf + packet_offset;
+            packet.bytes = packet_size;
+
+            long blocksize = vorbis_packet_blocksize(info, &packet);
+            if (blocksize < 0) {
+                g_warning("Invalid Vorbis audio packet in Ogg page @ 0x%08" G_GINT64_MODIFIER "x", page->offset);
+                return FALSE;
+            }
+
+            if (previous_blocksize >= 0) {
+                samples += previous_blocksize / 4 + blocksize / 4;
+            }
+            previous_blocksize = blocksize;
+        }
+
+        packet_offset += packet_size;
+        packet_size = 0;
+    }
+
+    *page_start = page->granulepos - samples;
+
+    return TRUE;
+}
+
+/* copies a page, with new sequence number and granule position (relative to granule_base) */
+static gboolean
+ogg_vorbis_copy_page(OpenedOGGVorbisFile *ogg, const OggVorbisPage *page, unsigned char *buf,
+        FILE *output_file, uint32_t sequence, int64_t granule_base, gboolean eos)
+{
+    if (io_pread(ogg->hdr.fp, buf, page->size, page->offset) != (gssize)page->size) {
+        g_warning("Could not read Ogg page @ 0x%08" G_GINT64_MODIFIER "x", page->offset);
+        return FALSE;
+    }
+
+    uint64_t granulepos = (page->granulepos >= 0) ? (uint64_t)(page->granulepos - granule_base) : (uint64_t)-1;
+
+    buf[5] = eos ? (buf[5] | OGG_PAGE_EOS) : (buf[5] & ~OGG_PAGE_EOS);
+    ogg_write_u32le(buf + 6, granulepos & 0xFFFFFFFF);
+    ogg_write_u32le(buf + 10, granulepos >> 32);
+    ogg_write_u32le(buf + 18, sequence);
+
+    ogg_page og;
+    og.header = buf;
+    og.header_len = OGG_PAGE_HEADER_SIZE + buf[26];
+    og.body = buf + og.header_len;
+    og.body_len = page->size - og.header_len;
+
+    ogg_page_checksum_set(&og);
+
+    return (fwrite(buf, 1, page->size, output_file) == page->size);
 }
 
 int
@@ -74,22 +440,140 @@ ogg_vorbis_write_file(OpenedAudioFile *self, const char *output_filename, unsign
 {
     OpenedOGGVorbisFile *ogg = (OpenedOGGVorbisFile *)self;
 
-    g_warning("TODO: Write file '%s', start=%lu, end=%lu", output_filename, start_pos, end_pos);
+    if (ogg->chained) {
+        g_warning("Cannot split chained Ogg file '%s'", ogg->hdr.filename);
+        return -1;
+    }
 
-    report_progress(0.0, report_progress_user_data);
+    start_pos /= ogg->hdr.sample_info.blockSize;
+    end_pos /= ogg->hdr.sample_info.blockSize;
 
-    uint32_t start_samples = start_pos / ogg->hdr.sample_info.blockSize * ogg->hdr.sample_info.samplesPerSec / CD_BLOCKS_PER_SEC;
-    uint32_t end_samples = end_pos / ogg->hdr.sample_info.blockSize * ogg->hdr.sample_info.samplesPerSec / CD_BLOCKS_PER_SEC;
+    uint64_t start_samples = (uint64_t)start_pos * ogg->hdr.sample_info.samplesPerSec / CD_BLOCKS_PER_SEC;
+    uint64_t end_samples = (uint64_t)end_pos * ogg->hdr.sample_info.samplesPerSec / CD_BLOCKS_PER_SEC;
 
     if (end_samples == 0) {
-        end_samples = ogg->hdr.sample_info.numBytes / ogg->hdr.sample_info.blockAlign;
+        end_samples = G_MAXUINT64;
+    }
+
+    GArray *pages = ogg_vorbis_get_page_index(ogg);
+    if (pages == NULL) {
+        return -1;
+    }
+
+    guint header_pages = ogg_vorbis_count_header_pages(pages);
+
+    /**
+     * From the first page starting at or after start_samples to the first page
+     * reaching end_samples. A page starts after the last packet that ended on
+     * one of the previous pages, its granule position is where it ends. Tracks
+     * start with a page that begins with a whole packet (which only primes the
+     * decoder, see ogg_vorbis_get_page_start()).
+     **/
+    guint first = pages->len;
+    guint last = pages->len - 1;
+    int64_t page_start = 0;
+    int64_t granule_base = 0;
+
+    for (guint i = header_pages; i < pages->len; ++i) {
+        const OggVorbisPage *page = &g_array_index(pages, OggVorbisPage, i);
+
+        if (first == pages->len && (uint64_t)page_start >= start_samples &&
+                !(page->header_type & OGG_PAGE_CONTINUED) && page->granulepos >= 0) {
+            first = i;
+        }
+
+        if (page->granulepos >= 0) {
+            if (first != pages->len && (uint64_t)page->granulepos >= end_samples) {
+                last = i;
+                break;
+            }
+
+            page_start = page->granulepos;
+        }
+    }
+
+    if (first == pages->len) {
+        g_warning("No Ogg pages to write to '%s'", output_filename);
+        return -1;
+    }
+
+    unsigned char *buf = g_malloc(OGG_PAGE_MAX_SIZE);
+
+    /* the first track keeps the granule positions of the file (including any trimming at the start) */
+    if (first > header_pages &&
+            !ogg_vorbis_get_page_start(ogg, &g_array_index(pages, OggVorbisPage, first), buf, &granule_base)) {
+        g_free(buf);
+        return -1;
+    }
+
+    uint64_t bytes_total = 0;
+    for (guint i = 0; i < header_pages; ++i) {
+        bytes_total += g_array_index(pages, OggVorbisPage, i).size;
+    }
+    const OggVorbisPage *first_page = &g_array_index(pages, OggVorbisPage, first);
+    const OggVorbisPage *last_page = &g_array_index(pages, OggVorbisPage, last);
+    bytes_total += last_page->offset + last_page->size - first_page->offset;
+
+    IoOutputFile *output = io_output_open(output_filename, bytes_total);
+
+    if (!output) {
+        g_warning("Could not open '%s' for writing", output_filename);
+        g_free(buf);
+        return -1;
+    }
+
+    FILE *output_file = io_output_get_fp(output);
+
+    report_progress(0.0, report_progress_user_data);
+
+    uint64_t bytes_done = 0;
+    uint32_t sequence = 0;
+    int result = 0;
+
+    /* the header pages are copied as-is, then the audio pages with granule positions starting at 0 */
+    for (guint i = 0; i <= last; ++i) {
+        if (i == header_pages) {
+            i = first;
+        }
+
+        const OggVorbisPage *page = &g_array_index(pages, OggVorbisPage, i);
+        gboolean is_header = (i < header_pages);
+
+        if (!ogg_vorbis_copy_page(ogg, page, buf, output_file, sequence++,
+                    is_header ? 0 : granule_base, !is_header && i == last)) {
+            g_warning("Failed to write Ogg page to '%s'", output_filename);
+            result = -1;
+            break;
+        }
+
+        bytes_done += page->size;
+        report_progress((double)bytes_done / (double)bytes_total, report_progress_user_data);
+    }
+
+    g_free(buf);
+
+    report_progress(1.0, report_progress_user_data);
+
+    if (!io_output_close(output)) {
+        g_warning("Failed to write to '%s'", output_filename);
+        result = -1;
     }
 
-    // TODO: Copy Ogg Vorbis samples from source to output file
-    (void)start_samples;
-    (void)end_samples;
+    return result;
+}
+
+static gboolean
+ogg_vorbis_can_write_file(OpenedAudioFile *self, char **error_message)
+{
+    OpenedOGGVorbisFile *ogg = (OpenedOGGVorbisFile *)self;
+
+    if (ogg->chained) {
+        format_module_set_error_message(error_message,
+                "%s contains several chained Ogg streams, splitting these is not supported", ogg->hdr.filename);
+        return FALSE;
+    }
 
-    return -1;
+    return TRUE;
 }
 
 static void
@@ -99,11 +583,40 @@ ogg_vorbis_close_file(const FormatModule *self, OpenedAudioFile *file)
 
     opened_audio_file_close(&ogg->hdr);
 
-    ov_clear(&ogg->ogg_vorbis_file);
+    if (ogg->decoder != NULL) {
+        ogg_vorbis_close_decoder(&g_steal_pointer(&ogg->decoder)->hdr);
+    }
+    g_mutex_clear(&ogg->decoder_mutex);
+    if (ogg->page_index != NULL) {
+        g_array_free(g_steal_pointer(&ogg->page_index), TRUE);
+    }
+    g_mutex_clear(&ogg->page_index_mutex);
 
     g_free(ogg);
 }
 
+static int
+ogg_vorbis_probe(const FormatModule *self, const char *filename, const unsigned char *head, size_t head_size)
+{
+    if (head_size >= 27 && memcmp(head, "OggS", 4) == 0) {
+        /* the first packet of the first page is the Vorbis identification header */
+        size_t packet_offset = 27 + head[26];
+
+        if (head_size >= packet_offset + 7 && memcmp(head + packet_offset, "\x01vorbis", 7) == 0) {
+            return FORMAT_PROBE_SCORE_MAX;
+        }
+
+        return FORMAT_PROBE_SCORE_LIKELY;
+    }
+
+    /* libvorbisfile can skip over junk at the start of the file */
+    if (format_module_filename_extension_check(self, filename, NULL)) {
+        return FORMAT_PROBE_SCORE_EXTENSION;
+    }
+
+    return FORMAT_PROBE_SCORE_NONE;
+}
+
 static OpenedAudioFile *
 ogg_vorbis_open_file(const FormatModule *self, const char *filename, char **error_message)
 {
@@ -116,22 +629,25 @@ ogg_vorbis_open_file(const FormatModule *self, const char *filename, char **erro
 
     SampleInfo *si = &ogg->hdr.sample_info;
 
-    ogg->ogg_vorbis_offset = 0;
+    g_mutex_init(&ogg->decoder_mutex);
+    g_mutex_init(&ogg->page_index_mutex);
 
     g_debug("Trying as Ogg Vorbis...");
-    int ogg_res = ov_fopen(ogg->hdr.filename, &ogg->ogg_vorbis_file);
+    int ogg_res;
 
-    if (ogg_res == 0) {
+    if ((ogg->decoder = ogg_vorbis_decoder_new(&ogg->hdr, &ogg_res)) != NULL) {
         g_debug("Detected Ogg Vorbis");
 
-        vorbis_info *info = ov_info(&ogg->ogg_vorbis_file, -1);
+        OggVorbis_File *vf = &ogg->decoder->ogg_vorbis_file;
+
+        vorbis_info *info = ov_info(vf, -1);
 
         g_debug("Ogg Vorbis info: version=%d, channels=%d, rate=%ld, samples=%ld",
-                info->version, info->channels, info->rate, (long int)ov_pcm_total(&ogg->ogg_vorbis_file, -1));
+                info->version, info->channels, info->rate, (long int)ov_pcm_total(vf, -1));
 
-        vorbis_comment *comment = ov_comment(&ogg->ogg_vorbis_file, -1);
+        vorbis_comment *comment = ov_comment(vf, -1);
 
-        long bitrate = ov_bitrate(&ogg->ogg_vorbis_file, -1);
+        long bitrate = ov_bitrate(vf, -1);
 
         if (bitrate == OV_EINVAL || bitrate == OV_FALSE) {
             bitrate = -1;
@@ -139,18 +655,22 @@ ogg_vorbis_open_file(const FormatModule *self, const char *filename, char **erro
             bitrate /= 1000;
         }
 
-        uint32_t serial = ov_serialnumber(&ogg->ogg_vorbis_file, -1) & 0xFFFFFFFF;
+        uint32_t serial = ov_serialnumber(vf, -1) & 0xFFFFFFFF;
 
         ogg->hdr.details = g_strdup_printf("%s, serial %08"PRIx32", %ld kbps", comment->vendor, serial, bitrate);
 
         si->channels = info->channels;
         si->samplesPerSec = info->rate;
-        si->bitsPerSample = 16;
+        /* samples are decoded with ov_read_float(), without converting them to integers */
+        si->bitsPerSample = 32;
+        si->isFloat = 1;
 
         si->blockAlign = si->channels * (si->bitsPerSample / 8);
         si->avgBytesPerSec = si->blockAlign * si->samplesPerSec;
         si->blockSize = si->avgBytesPerSec / CD_BLOCKS_PER_SEC;
-        si->numBytes = ov_pcm_total(&ogg->ogg_vorbis_file, -1) * si->blockAlign;
+        si->numBytes = ov_pcm_total(vf, -1) * si->blockAlign;
+
+        ogg->chained = (ov_streams(vf) > 1);
     } else {
         format_module_set_error_message(error_message, "ov_fopen() returned %d, probably not an Ogg file", ogg_res);
         goto error;
@@ -170,10 +690,16 @@ OGG_VORBIS_FORMAT_MODULE = {
     .library_name = "libvorbisfile",
     .default_file_extension = ".ogg",
 
+    .probe = ogg_vorbis_probe,
     .open_file = ogg_vorbis_open_file,
     .close_file = ogg_vorbis_close_file,
 
     .read_samples = ogg_vorbis_read_samples,
+    .open_decoder = ogg_vorbis_open_decoder,
+    .decoder_read_samples = ogg_vorbis_decoder_read_samples,
+    .close_decoder = ogg_vorbis_close_decoder,
+    .parallel_decode = TRUE,
+    .can_write_file = ogg_vorbis_can_write_file,
     .write_file = ogg_vorbis_write_file,
 };
 
@@ -20,16 +20,44 @@
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <stdint.h>
 
 #include <glib.h>
 
 #include "format_wav.h"
+#include "io_engine.h"
+#include "appconfig.h"
 #include "gettext.h"
 
 #define RiffID "RIFF"
+#define RF64ID "RF64"
+#define BW64ID "BW64"
 #define WaveID "WAVE"
+#define DataSize64ID "ds64"
 #define FormatID "fmt "
 #define WaveDataID "data"
+#define FactID "fact"
+#define JunkID "JUNK"
+
+#define WAVE_FORMAT_PCM 0x0001
+#define WAVE_FORMAT_IEEE_FLOAT 0x0003
+#define WAVE_FORMAT_EXTENSIBLE 0xFFFE
+
+/* Space reserved for the header when writing, including the padding for aligning the data */
+#define WAV_HEADER_RESERVE_SIZE (64 * 1024)
+
+/* 32-bit chunk size value in RF64 files, meaning "see ds64 chunk" */
+#define RF64_SIZE_IN_DS64 0xFFFFFFFF
+
+/* Sony Wave64 uses GUIDs instead of chunk IDs, the first four bytes are the RIFF chunk ID */
+static const unsigned char
+WAVE64_RIFF_GUID[16] = { 'r', 'i', 'f', 'f', 0x2e, 0x91, 0xcf, 0x11, 0xa5, 0xd6, 0x28, 0xdb, 0x04, 0xc1, 0x00, 0x00 };
+static const unsigned char
+WAVE64_WAVE_GUID[16] = { 'w', 'a', 'v', 'e', 0xf3, 0xac, 0xd3, 0x11, 0x8c, 0xd1, 0x00, 0xc0, 0x4f, 0x8e, 0xdb, 0x8a };
+
+/* WAVE_FORMAT_EXTENSIBLE sub formats, the first two bytes are the format tag */
+static const unsigned char
+KSDATAFORMAT_SUBTYPE_GUID_TAIL[14] = { 0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71 };
 
 typedef char ID[4];
 
@@ -45,20 +73,49 @@ typedef struct {
 } ChunkHeader;
 
 typedef struct {
-	short wFormatTag;
+	unsigned short wFormatTag;
 	unsigned short  wChannels;
 	unsigned int   dwSamplesPerSec;
 	unsigned int   dwAvgBytesPerSec;
 	unsigned short  wBlockAlign;
 	unsigned short  wBitsPerSample;
-//	unsigned short  extraNonPcm;
 } FormatChunk;
 
+/* follows the FormatChunk if wFormatTag is WAVE_FORMAT_EXTENSIBLE */
+typedef struct {
+	unsigned short cbSize;
+	unsigned short wValidBitsPerSample;
+	unsigned int   dwChannelMask;
+	unsigned char  subFormat[16];
+} FormatChunkExtensible;
+
+/* 64-bit values are stored as bytes, as the chunk is not 8-byte aligned */
+typedef struct {
+	unsigned char riffSize[8];
+	unsigned char dataSize[8];
+	unsigned char sampleCount[8];
+	uint32_t tableLength;
+} DataSize64Chunk;
+
+typedef struct {
+	unsigned char chunkGUID[16];
+	uint64_t chunkSize;
+} Wave64ChunkHeader;
+
+typedef enum {
+    WAV_CONTAINER_RIFF = 0,
+    WAV_CONTAINER_RF64,
+    WAV_CONTAINER_WAVE64,
+} WavContainer;
+
 
 typedef struct OpenedWavFile_ OpenedWavFile;
 struct OpenedWavFile_ {
     OpenedAudioFile hdr;
 
+    WavContainer container;
+    gboolean extensible;
+    FormatChunkExtensible fmtExt;
     unsigned long wavDataPtr;
     unsigned long wavDataSize;
 };
@@ -72,13 +129,77 @@ wav_close_file(const FormatModule *self, OpenedAudioFile *file)
     g_free(wav);
 }
 
+static int
+wav_probe(const FormatModule *self, const char *filename, const unsigned char *head, size_t head_size)
+{
+    if (head_size < sizeof(WaveHeader)) {
+        return FORMAT_PROBE_SCORE_NONE;
+    }
+
+    const WaveHeader *wavHdr = (const WaveHeader *)head;
+
+    gboolean has_riff = (memcmp(wavHdr->riffID, RiffID, 4) == 0 ||
+            memcmp(wavHdr->riffID, RF64ID, 4) == 0 || memcmp(wavHdr->riffID, BW64ID, 4) == 0);
+    gboolean has_wave = (memcmp(wavHdr->wavID, WaveID, 4) == 0);
+
+    if (has_riff && has_wave) {
+        return FORMAT_PROBE_SCORE_MAX;
+    } else if (head_size >= sizeof(WAVE64_RIFF_GUID) && memcmp(head, WAVE64_RIFF_GUID, sizeof(WAVE64_RIFF_GUID)) == 0) {
+        return FORMAT_PROBE_SCORE_MAX;
+    } else if (has_riff || has_wave) {
+        /* wav_open_file() accepts either of the two */
+        return FORMAT_PROBE_SCORE_LIKELY;
+    }
+
+    return FORMAT_PROBE_SCORE_NONE;
+}
+
+static gboolean
+wav_read_chunk_header(OpenedWavFile *wav, ID chunkID, uint64_t *chunkSize)
+{
+    if (wav->container == WAV_CONTAINER_WAVE64) {
+        Wave64ChunkHeader w64Hdr;
+
+        if (fread(&w64Hdr, sizeof(Wave64ChunkHeader), 1, wav->hdr.fp) < 1 || w64Hdr.chunkSize < sizeof(Wave64ChunkHeader)) {
+            return FALSE;
+        }
+
+        /* the first four bytes of the GUID are the RIFF chunk ID */
+        memcpy(chunkID, w64Hdr.chunkGUID, 4);
+        *chunkSize = w64Hdr.chunkSize - sizeof(Wave64ChunkHeader);
+    } else {
+        ChunkHeader chunkHdr;
+
+        if (fread(&chunkHdr, sizeof(ChunkHeader), 1, wav->hdr.fp) < 1) {
+            return FALSE;
+        }
+
+        memcpy(chunkID, chunkHdr.chunkID, 4);
+        *chunkSize = (uint32_t)chunkHdr.chunkSize;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+wav_skip_chunk(OpenedWavFile *wav, uint64_t chunkSize)
+{
+    /* chunks are aligned to 2 bytes (RIFF) or 8 bytes (Wave64) */
+    uint64_t alignment = (wav->container == WAV_CONTAINER_WAVE64) ? 8 : 2;
+    uint64_t padding = (alignment - chunkSize % alignment) % alignment;
+
+    return fseek(wav->hdr.fp, chunkSize + padding, SEEK_CUR) == 0;
+}
+
 static OpenedAudioFile *
 wav_open_file(const FormatModule *self, const char *filename, char **error_message)
 {
     const char *CHUNK_ERROR_MESSAGE = _("Error reading chunk. Maybe the wave file you are trying to load is truncated?");
 
     WaveHeader wavHdr;
-    ChunkHeader chunkHdr;
+    ID chunkID;
+    uint64_t chunkSize;
+    uint64_t ds64DataSize = 0;
     FormatChunk fmtChunk;
     char str[128];
 
@@ -105,29 +226,61 @@ wav_open_file(const FormatModule *self, const char *filename, char **error_messa
         goto error;
     }
 
-    if (memcmp(wavHdr.riffID, RiffID, 4) && memcmp(wavHdr.wavID, WaveID, 4)) {
+    if (memcmp(wavHdr.riffID, RF64ID, 4) == 0 || memcmp(wavHdr.riffID, BW64ID, 4) == 0) {
+        wav->container = WAV_CONTAINER_RF64;
+    } else if (memcmp(&wavHdr, WAVE64_RIFF_GUID, sizeof(WaveHeader)) == 0) {
+        wav->container = WAV_CONTAINER_WAVE64;
+    } else if (memcmp(wavHdr.riffID, RiffID, 4) && memcmp(wavHdr.wavID, WaveID, 4)) {
         format_module_set_error_message(error_message, _("%s is not a wave file."), wav->hdr.filename);
         goto error;
     }
 
+    if (wav->container == WAV_CONTAINER_WAVE64) {
+        /* rest of the riff GUID, 64-bit file size and wave GUID */
+        unsigned char w64Hdr[sizeof(Wave64ChunkHeader) + 16 - sizeof(WaveHeader)];
+
+        if (fread(w64Hdr, sizeof(w64Hdr), 1, wav->hdr.fp) < 1 ||
+                memcmp(w64Hdr + sizeof(w64Hdr) - 16, WAVE64_WAVE_GUID, 16) != 0) {
+            format_module_set_error_message(error_message, _("%s is not a wave file."), wav->hdr.filename);
+            goto error;
+        }
+
+        wav->hdr.details = g_strdup("Sony Wave64");
+    } else if (wav->container == WAV_CONTAINER_RF64) {
+        /* the ds64 chunk must follow the header directly */
+        DataSize64Chunk ds64Chunk;
+
+        if (!wav_read_chunk_header(wav, chunkID, &chunkSize) || memcmp(chunkID, DataSize64ID, 4) ||
+                chunkSize < sizeof(DataSize64Chunk) ||
+                fread(&ds64Chunk, sizeof(DataSize64Chunk), 1, wav->hdr.fp) < 1 ||
+                !wav_skip_chunk(wav, chunkSize - sizeof(DataSize64Chunk))) {
+            format_module_set_error_message(error_message, "%s", _("Cannot read RF64 ds64 chunk."));
+            goto error;
+        }
+
+        memcpy(&ds64DataSize, ds64Chunk.dataSize, sizeof(ds64DataSize));
+
+        wav->hdr.details = g_strdup_printf("%.4s (64-bit RIFF)", wavHdr.riffID);
+    }
+
     /* read in format chunk header */
 
-    if (fread(&chunkHdr, sizeof(ChunkHeader), 1, wav->hdr.fp) < 1) {
+    if (!wav_read_chunk_header(wav, chunkID, &chunkSize)) {
         format_module_set_error_message(error_message, "%s", CHUNK_ERROR_MESSAGE);
         goto error;
     }
 
-    while (memcmp(chunkHdr.chunkID, FormatID, 4)) {
-        memcpy(str, chunkHdr.chunkID, 4);
+    while (memcmp(chunkID, FormatID, 4)) {
+        memcpy(str, chunkID, 4);
         str[4] = '\0';
         g_warning("Chunk %s is not a Format Chunk", str);
 
-        if (fseek(wav->hdr.fp, chunkHdr.chunkSize, SEEK_CUR)) {
-            format_module_set_error_message(error_message, _("Error seeking to %u in %s: %s"), chunkHdr.chunkSize, wav->hdr.filename, strerror(errno));
+        if (!wav_skip_chunk(wav, chunkSize)) {
+            format_module_set_error_message(error_message, _("Error seeking to %u in %s: %s"), (unsigned int)chunkSize, wav->hdr.filename, strerror(errno));
             goto error;
         }
 
-        if (fread(&chunkHdr, sizeof(ChunkHeader), 1, wav->hdr.fp) < 1) {
+        if (!wav_read_chunk_header(wav, chunkID, &chunkSize)) {
             format_module_set_error_message(error_message, "%s", CHUNK_ERROR_MESSAGE);
             goto error;
         }
@@ -140,7 +293,41 @@ wav_open_file(const FormatModule *self, const char *filename, char **error_messa
         goto error;
     }
 
-    if (fmtChunk.wFormatTag != 1) {
+    unsigned short formatTag = fmtChunk.wFormatTag;
+    uint64_t fmtSize = sizeof(FormatChunk);
+
+    if (formatTag == WAVE_FORMAT_EXTENSIBLE) {
+        if (chunkSize < sizeof(FormatChunk) + sizeof(FormatChunkExtensible) ||
+                fread(&wav->fmtExt, sizeof(FormatChunkExtensible), 1, wav->hdr.fp) < 1) {
+            format_module_set_error_message(error_message, _("Error reading format chunk: %s"), strerror(errno));
+            goto error;
+        }
+
+        fmtSize += sizeof(FormatChunkExtensible);
+
+        if (memcmp(wav->fmtExt.subFormat + 2, KSDATAFORMAT_SUBTYPE_GUID_TAIL, sizeof(KSDATAFORMAT_SUBTYPE_GUID_TAIL)) != 0) {
+            format_module_set_error_message(error_message, "%s", _("Loading compressed wave data is not supported."));
+            goto error;
+        }
+
+        wav->extensible = TRUE;
+        formatTag = wav->fmtExt.subFormat[0] | (wav->fmtExt.subFormat[1] << 8);
+    }
+
+    if (formatTag == WAVE_FORMAT_IEEE_FLOAT) {
+        if (fmtChunk.wBitsPerSample != 32) {
+            format_module_set_error_message(error_message, _("Loading %d-bit floating point wave data is not supported."), fmtChunk.wBitsPerSample);
+            goto error;
+        }
+
+        wav->hdr.sample_info.isFloat = 1;
+    } else if (formatTag == WAVE_FORMAT_PCM) {
+        if (fmtChunk.wBitsPerSample != 8 && fmtChunk.wBitsPerSample != 16 &&
+                fmtChunk.wBitsPerSample != 24 && fmtChunk.wBitsPerSample != 32) {
+            format_module_set_error_message(error_message, _("Loading %d-bit wave data is not supported."), fmtChunk.wBitsPerSample);
+            goto error;
+        }
+    } else {
         format_module_set_error_message(error_message, "%s", _("Loading compressed wave data is not supported."));
         goto error;
     }
@@ -153,36 +340,43 @@ wav_open_file(const FormatModule *self, const char *filename, char **error_messa
     wav->hdr.sample_info.blockSize      = wav->hdr.sample_info.avgBytesPerSec / CD_BLOCKS_PER_SEC;
 
     // if we have a FormatChunk that is larger than standard size, skip over extra data
-    if (chunkHdr.chunkSize > sizeof(FormatChunk)) {
-        if (fseek(wav->hdr.fp, chunkHdr.chunkSize - sizeof(FormatChunk), SEEK_CUR)) {
-            format_module_set_error_message(error_message, _("Error seeking to %u in %s: %s"), chunkHdr.chunkSize, wav->hdr.filename, strerror(errno));
+    if (chunkSize > fmtSize) {
+        if (!wav_skip_chunk(wav, chunkSize - fmtSize)) {
+            format_module_set_error_message(error_message, _("Error seeking to %u in %s: %s"), (unsigned int)chunkSize, wav->hdr.filename, strerror(errno));
             goto error;
         }
     }
 
     /* read in wav data header */
 
-    if (fread(&chunkHdr, sizeof(ChunkHeader), 1, wav->hdr.fp) < 1) {
+    if (!wav_read_chunk_header(wav, chunkID, &chunkSize)) {
         format_module_set_error_message(error_message, "%s", CHUNK_ERROR_MESSAGE);
         goto error;
     }
 
-    while (memcmp(chunkHdr.chunkID, WaveDataID, 4)) {
-        memcpy(str, chunkHdr.chunkID, 4);
-        str[4] = '\0';
-        g_warning("Chunk %s is not a Format Chunk", str);
+    while (memcmp(chunkID, WaveDataID, 4)) {
+        if (memcmp(chunkID, JunkID, 4)) {
+            memcpy(str, chunkID, 4);
+            str[4] = '\0';
+            g_warning("Chunk %s is not a Data Chunk", str);
+        }
 
-        if (fseek(wav->hdr.fp, chunkHdr.chunkSize, SEEK_CUR)) {
-            format_module_set_error_message(error_message, _("Error seeking to %u in %s: %s"), chunkHdr.chunkSize, wav->hdr.filename, strerror(errno));
+        if (!wav_skip_chunk(wav, chunkSize)) {
+            format_module_set_error_message(error_message, _("Error seeking to %u in %s: %s"), (unsigned int)chunkSize, wav->hdr.filename, strerror(errno));
             goto error;
         }
 
-        if (fread(&chunkHdr, sizeof(ChunkHeader), 1, wav->hdr.fp) < 1) {
+        if (!wav_read_chunk_header(wav, chunkID, &chunkSize)) {
             format_module_set_error_message(error_message, "%s", CHUNK_ERROR_MESSAGE);
             goto error;
         }
     }
 
+    if (wav->container == WAV_CONTAINER_RF64 && chunkSize == RF64_SIZE_IN_DS64) {
+        /* the real size is stored in the ds64 chunk */
+        chunkSize = ds64DataSize;
+    }
+
     long x;
     if ((x = ftell(wav->hdr.fp)) >= 0) {
         wav->wavDataPtr = x;
@@ -193,16 +387,21 @@ wav_open_file(const FormatModule *self, const char *filename, char **error_messa
      * use the header's size info here, but use the 
      * real file size, minus the header's size.
      ***/
-    if (wav->wavDataSize != 0 && chunkHdr.chunkSize > wav->wavDataSize) {
-        g_warning("Real file size is %lu, but wave header says it should be %d. Using real file size instead.",
-                wav->wavDataSize, chunkHdr.chunkSize);
+    if (wav->wavDataSize != 0 && chunkSize > wav->wavDataSize - wav->wavDataPtr) {
+        g_warning("Real file size is %lu, but wave header says it should be %" G_GUINT64_FORMAT ". Using real file size instead.",
+                wav->wavDataSize, chunkSize);
         wav->wavDataSize = wav->wavDataSize - wav->wavDataPtr;
+    } else if (chunkSize > G_MAXULONG) {
+        format_module_set_error_message(error_message, "%s", _("Wave file is too large for this platform."));
+        goto error;
     } else {
-        wav->wavDataSize = chunkHdr.chunkSize;
+        wav->wavDataSize = chunkSize;
     }
 
     wav->hdr.sample_info.numBytes = wav->wavDataSize;
 
+    format_module_map_file(&wav->hdr);
+
     return &wav->hdr;
 
 error:
@@ -216,10 +415,6 @@ wav_read_samples(OpenedAudioFile *self, unsigned char *buf, size_t buf_size, uns
 {
     OpenedWavFile *wav = (OpenedWavFile *)self;
 
-    if (fseek(wav->hdr.fp, start_pos + wav->wavDataPtr, SEEK_SET)) {
-        return -1;
-    }
-
     if (start_pos > wav->wavDataSize) {
         return -1;
     }
@@ -228,89 +423,124 @@ wav_read_samples(OpenedAudioFile *self, unsigned char *buf, size_t buf_size, uns
         buf_size = wav->wavDataSize - start_pos;
     }
 
-    return fread(buf, 1, buf_size, wav->hdr.fp);
+    /* positional read, so that multiple threads can read at once */
+    return io_pread(wav->hdr.fp, buf, buf_size, wav->wavDataPtr + start_pos);
+}
+
+static gboolean
+wav_get_file_range(OpenedAudioFile *self, unsigned long start_pos, uint64_t *offset, uint64_t *length)
+{
+    OpenedWavFile *wav = (OpenedWavFile *)self;
+
+    if (start_pos > wav->wavDataSize) {
+        return FALSE;
+    }
+
+    *offset = wav->wavDataPtr + start_pos;
+    *length = wav->wavDataSize - start_pos;
+
+    return TRUE;
+}
+
+static const unsigned char *
+wav_map_samples(OpenedAudioFile *self, unsigned long start_pos, size_t *buf_size)
+{
+    OpenedWavFile *wav = (OpenedWavFile *)self;
+
+    if (start_pos > wav->wavDataSize) {
+        return NULL;
+    }
+
+    return format_module_get_mapped_data(&wav->hdr, wav->wavDataPtr + start_pos, wav->wavDataSize - start_pos, buf_size);
 }
 
+static int
+wav_write_header(FILE *fp, const SampleInfo *sample_info, unsigned long num_bytes, const FormatChunkExtensible *fmtExt,
+        uint32_t align, uint64_t align_offset);
+
 int
 wav_write_file(OpenedAudioFile *self, const char *output_filename, unsigned long start_pos, unsigned long end_pos, report_progress_func report_progress, void *report_progress_user_data)
 {
     OpenedWavFile *wav = (OpenedWavFile *)self;
 
-    int buf_size = wav->hdr.sample_info.blockSize;
-
-    int ret;
-    FILE *new_fp = NULL;
-    unsigned long cur_pos, num_bytes;
-    unsigned char *buf = malloc(buf_size);
+    IoOutputFile *output = NULL;
+    FILE *new_fp;
+    unsigned long num_bytes;
+    long header_size;
 
     if (start_pos > wav->wavDataSize) {
         goto error;
     }
 
-    if ((new_fp = fopen(output_filename, "wb")) == NULL) {
+    if (end_pos == 0 || end_pos > wav->wavDataSize) {
+        end_pos = wav->wavDataSize;
+    }
+
+    num_bytes = end_pos - start_pos;
+
+    if ((output = io_output_open(output_filename, WAV_HEADER_RESERVE_SIZE + num_bytes)) == NULL) {
         g_warning("Error opening %s for writing", output_filename);
         goto error;
     }
 
-    start_pos += wav->wavDataPtr;
-    if (end_pos != 0) {
-        end_pos += wav->wavDataPtr;
-        num_bytes = end_pos - start_pos;
-    } else {
-        num_bytes = wav->wavDataSize + wav->wavDataPtr - start_pos;
-    }
-    cur_pos = start_pos;
+    new_fp = io_output_get_fp(output);
+
+    /**
+     * Optionally, the sample data is placed at the same offset within a file system block
+     * as in the source file, so that io_copy() can clone the blocks instead of copying them.
+     **/
+    uint32_t align = appconfig_get_align_wav_data() ? io_get_block_size(new_fp) : 0;
 
-    if ((wav_write_file_header(new_fp, &wav->hdr.sample_info, num_bytes)) != 0) {
+    /* sample data is copied as-is, so the output has the same format chunk */
+    if ((wav_write_header(new_fp, &wav->hdr.sample_info, num_bytes, wav->extensible ? &wav->fmtExt : NULL,
+                    align, wav->wavDataPtr + start_pos)) != 0) {
         g_message("Could not write WAV header to %s", output_filename);
         goto error;
     }
 
-    if (fseek(wav->hdr.fp, cur_pos, SEEK_SET)) {
-        g_message("Could not seek to read position in %s", wav->hdr.filename);
+    if ((header_size = ftell(new_fp)) < 0) {
         goto error;
     }
 
     report_progress(0.0, report_progress_user_data);
 
-    while ((ret = fread(buf, 1, buf_size, wav->hdr.fp)) > 0 &&
-                (cur_pos < end_pos || end_pos == 0)) {
-        if ((fwrite(buf, 1, ret, new_fp)) < ret) {
-            g_message("Error writing to file %s", output_filename);
-            goto error;
-        }
-
-        cur_pos += ret;
-        report_progress((double)(cur_pos - start_pos) / num_bytes, report_progress_user_data);
+    if (io_copy(wav->hdr.fp, wav->wavDataPtr + start_pos, new_fp, header_size, num_bytes,
+                report_progress, report_progress_user_data) < 0) {
+        g_message("Error copying samples from %s to %s", wav->hdr.filename, output_filename);
+        goto error;
     }
 
-    free(buf);
-    fclose(new_fp);
+    if (!io_output_close(g_steal_pointer(&output))) {
+        g_message("Error writing to %s", output_filename);
+        goto error;
+    }
 
     report_progress(1.0, report_progress_user_data);
 
-    return ret;
+    return 0;
 
 error:
-    if (new_fp != NULL) {
-        fclose(new_fp);
+    if (output != NULL) {
+        io_output_close(output);
     }
 
-    free(buf);
     return -1;
 }
 
-
 static const FormatModule
 WAV_FORMAT_MODULE = {
     .name = "RIFF WAVE",
     .library_name = "built-in",
     .default_file_extension = ".wav",
 
+    .probe = wav_probe,
     .open_file = wav_open_file,
     .close_file = wav_close_file,
 
     .read_samples = wav_read_samples,
+    .map_samples = wav_map_samples,
+    .get_file_range = wav_get_file_range,
+    .aligned_output = TRUE,
     .write_file = wav_write_file,
 };
 
@@ -325,15 +555,75 @@ int
 wav_write_file_header(FILE *fp,
                       SampleInfo *sample_info,
                       unsigned long num_bytes)
+{
+    return wav_write_header(fp, sample_info, num_bytes, NULL, 0, 0);
+}
+
+/* if align is non-zero, a JUNK chunk is added so that the data starts at align_offset modulo align */
+static int
+wav_write_header(FILE *fp,
+                 const SampleInfo *sample_info,
+                 unsigned long num_bytes,
+                 const FormatChunkExtensible *fmtExt,
+                 uint32_t align,
+                 uint64_t align_offset)
 {
     WaveHeader wavHdr;
     ChunkHeader chunkHdr;
     FormatChunk fmtChunk;
 
+    /**
+     * Integer samples use a plain PCM format chunk, float samples an
+     * IEEE float format chunk with an (empty) extension. The extensible
+     * format (channel mask, valid bits) is kept if the source used it.
+     * Everything except plain PCM needs a fact chunk with the frame count.
+     **/
+    unsigned short formatTag = sample_info->isFloat ? WAVE_FORMAT_IEEE_FLOAT : WAVE_FORMAT_PCM;
+    uint32_t fmtSize = sizeof(FormatChunk);
+
+    if (fmtExt != NULL) {
+        formatTag = WAVE_FORMAT_EXTENSIBLE;
+        fmtSize += sizeof(FormatChunkExtensible);
+    } else if (formatTag != WAVE_FORMAT_PCM) {
+        fmtSize += sizeof(unsigned short);
+    }
+
+    uint32_t factSize = (formatTag != WAVE_FORMAT_PCM) ? sizeof(ChunkHeader) + sizeof(uint32_t) : 0;
+
+    uint64_t riffSize = (uint64_t)num_bytes + sizeof(ChunkHeader) + fmtSize + factSize
+                                            + sizeof(ChunkHeader) + 4;
+
+    /* promote to RF64 if the sizes don't fit into 32 bits (with room for the JUNK chunk) */
+    uint64_t maxJunkSize = (align > 0) ? sizeof(ChunkHeader) + align : 0;
+    gboolean rf64 = (riffSize + sizeof(ChunkHeader) + sizeof(DataSize64Chunk) + maxJunkSize > RF64_SIZE_IN_DS64);
+    uint64_t sampleCount = num_bytes / sample_info->blockAlign;
+
+    uint64_t headerSize = sizeof(WaveHeader) + (rf64 ? sizeof(ChunkHeader) + sizeof(DataSize64Chunk) : 0) +
+                          sizeof(ChunkHeader) + fmtSize + factSize + sizeof(ChunkHeader);
+    uint32_t junkSize = 0;
+    gboolean junk = FALSE;
+
+    if (align > 0) {
+        uint64_t junkEnd = headerSize + sizeof(ChunkHeader);
+        junkSize = (align_offset % align + align - junkEnd % align) % align;
+
+        /* chunks are word-aligned, so an odd data offset can't be matched */
+        if (junkSize % 2 == 0) {
+            junk = TRUE;
+            riffSize += sizeof(ChunkHeader) + junkSize;
+        }
+    }
+
     /* Write wave header */
-    memcpy(wavHdr.riffID, RiffID, 4);
-    wavHdr.totSize = num_bytes + sizeof(ChunkHeader) + sizeof(FormatChunk)
-                               + sizeof(ChunkHeader) + 4;
+    if (rf64) {
+        riffSize += sizeof(ChunkHeader) + sizeof(DataSize64Chunk);
+
+        memcpy(wavHdr.riffID, RF64ID, 4);
+        wavHdr.totSize = RF64_SIZE_IN_DS64;
+    } else {
+        memcpy(wavHdr.riffID, RiffID, 4);
+        wavHdr.totSize = riffSize;
+    }
     memcpy(wavHdr.wavID, WaveID, 4);
 
     if ((fwrite(&wavHdr, sizeof(WaveHeader), 1, fp)) < 1) {
@@ -341,9 +631,29 @@ wav_write_file_header(FILE *fp,
         return 1;
     }
 
+    if (rf64) {
+        DataSize64Chunk ds64Chunk;
+        uint64_t dataSize = num_bytes;
+
+        /* Write ds64 chunk header and data */
+        memcpy(chunkHdr.chunkID, DataSize64ID, 4);
+        chunkHdr.chunkSize = sizeof(DataSize64Chunk);
+
+        memcpy(ds64Chunk.riffSize, &riffSize, 8);
+        memcpy(ds64Chunk.dataSize, &dataSize, 8);
+        memcpy(ds64Chunk.sampleCount, &sampleCount, 8);
+        ds64Chunk.tableLength = 0;
+
+        if ((fwrite(&chunkHdr, sizeof(ChunkHeader), 1, fp)) < 1 ||
+                fwrite(&ds64Chunk, sizeof(DataSize64Chunk), 1, fp) < 1) {
+            printf("error writing ds64 chunk\n");
+            return 1;
+        }
+    }
+
     /* Write format chunk header */
     memcpy(chunkHdr.chunkID, FormatID, 4);
-    chunkHdr.chunkSize = sizeof(FormatChunk);
+    chunkHdr.chunkSize = fmtSize;
 
     if ((fwrite(&chunkHdr, sizeof(ChunkHeader), 1, fp)) < 1) {
         printf("error writing fmt chunk header\n");
@@ -351,7 +661,7 @@ wav_write_file_header(FILE *fp,
     }
 
     /* Write format chunk data */
-    fmtChunk.wFormatTag            = 1;
+    fmtChunk.wFormatTag            = formatTag;
     fmtChunk.wChannels            = sample_info->channels;
     fmtChunk.dwSamplesPerSec    = sample_info->samplesPerSec;
     fmtChunk.dwAvgBytesPerSec    = sample_info->avgBytesPerSec;
@@ -363,9 +673,57 @@ wav_write_file_header(FILE *fp,
         return 1;
     }
 
+    if (fmtExt != NULL) {
+        FormatChunkExtensible ext = *fmtExt;
+        ext.cbSize = sizeof(FormatChunkExtensible) - sizeof(unsigned short);
+
+        if (fwrite(&ext, sizeof(FormatChunkExtensible), 1, fp) < 1) {
+            printf("error writing format chunk\n");
+            return 1;
+        }
+    } else if (formatTag != WAVE_FORMAT_PCM) {
+        unsigned short cbSize = 0;
+
+        if (fwrite(&cbSize, sizeof(cbSize), 1, fp) < 1) {
+            printf("error writing format chunk\n");
+            return 1;
+        }
+    }
+
+    if (factSize != 0) {
+        /* Write fact chunk header and data */
+        uint32_t sampleLength = rf64 ? RF64_SIZE_IN_DS64 : sampleCount;
+
+        memcpy(chunkHdr.chunkID, FactID, 4);
+        chunkHdr.chunkSize = sizeof(uint32_t);
+
+        if ((fwrite(&chunkHdr, sizeof(ChunkHeader), 1, fp)) < 1 ||
+                fwrite(&sampleLength, sizeof(sampleLength), 1, fp) < 1) {
+            printf("error writing fact chunk\n");
+            return 1;
+        }
+    }
+
+    if (junk) {
+        /* Write JUNK chunk header and (zero) padding */
+        unsigned char *padding = g_malloc0(junkSize);
+
+        memcpy(chunkHdr.chunkID, JunkID, 4);
+        chunkHdr.chunkSize = junkSize;
+
+        if ((fwrite(&chunkHdr, sizeof(ChunkHeader), 1, fp)) < 1 ||
+                fwrite(padding, 1, junkSize, fp) < junkSize) {
+            printf("error writing JUNK chunk\n");
+            g_free(padding);
+            return 1;
+        }
+
+        g_free(padding);
+    }
+
     /* Write data chunk header */
     memcpy(chunkHdr.chunkID, WaveDataID, 4);
-    chunkHdr.chunkSize = num_bytes;
+    chunkHdr.chunkSize = rf64 ? RF64_SIZE_IN_DS64 : num_bytes;
 
     if ((fwrite(&chunkHdr, sizeof(ChunkHeader), 1, fp)) < 1) {
         printf("error writing data chunk header\n");
@@ -375,6 +733,16 @@ wav_write_file_header(FILE *fp,
     return 0;
 }
 
+static void
+merge_progress_changed(double progress, void *user_data)
+{
+    WriteInfo *write_info = user_data;
+
+    if (write_info != NULL) {
+        write_info->pct_done = progress;
+    }
+}
+
 int
 wav_merge_files(char *filename,
                 int num_files,
@@ -382,12 +750,15 @@ wav_merge_files(char *filename,
                 WriteInfo *write_info)
 {
     int i;
-    int ret = 0;
     SampleInfo sample_info[num_files];
     unsigned long data_ptr[num_files];
+    gboolean extensible = FALSE;
+    FormatChunkExtensible fmtExt;
+    IoOutputFile *output;
     FILE *new_fp, *read_fp;
-    unsigned long cur_pos, end_pos, num_bytes;
-    unsigned char buf[DEFAULT_BUF_SIZE];
+    unsigned long num_bytes;
+    long out_pos;
+    int64_t copied;
 
     if( write_info != NULL) {
         write_info->num_files = num_files;
@@ -412,6 +783,10 @@ wav_merge_files(char *filename,
         } else {
             sample_info[i] = oaf->sample_info;
             data_ptr[i] = wav->wavDataPtr;
+            if (i == 0) {
+                extensible = wav->extensible;
+                fmtExt = wav->fmtExt;
+            }
             mod->close_file(mod, oaf);
         }
     }
@@ -432,18 +807,27 @@ wav_merge_files(char *filename,
         } else if (sample_info[0].bitsPerSample != 
                             sample_info[i].bitsPerSample) {
             return 1;
+        } else if (sample_info[0].isFloat != sample_info[i].isFloat) {
+            return 1;
         }
 
         num_bytes += sample_info[i].numBytes;
     }
 
-    if ((new_fp = fopen(filename, "wb")) == NULL) {
+    if ((output = io_output_open(filename, WAV_HEADER_RESERVE_SIZE + num_bytes)) == NULL) {
         printf("error opening %s for writing\n", filename);
         return -1;
     }
 
-    if ((wav_write_file_header(new_fp, &sample_info[0], num_bytes)) != 0) {
-        fclose(new_fp);
+    new_fp = io_output_get_fp(output);
+
+    if ((wav_write_header(new_fp, &sample_info[0], num_bytes, extensible ? &fmtExt : NULL, 0, 0)) != 0) {
+        io_output_close(output);
+        return -1;
+    }
+
+    if ((out_pos = ftell(new_fp)) < 0) {
+        io_output_close(output);
         return -1;
     }
 
@@ -459,39 +843,22 @@ wav_merge_files(char *filename,
 
         if ((read_fp = fopen(filenames[i], "rb")) == NULL) {
             printf("error opening %s for reading\n", filenames[i]);
-            fclose(new_fp);
-            fclose(read_fp);
+            io_output_close(output);
             return -1;
         }
 
-        cur_pos = data_ptr[i];
-        num_bytes = sample_info[i].numBytes;
-        end_pos = cur_pos + num_bytes;
+        copied = io_copy(read_fp, data_ptr[i], new_fp, out_pos, sample_info[i].numBytes,
+                merge_progress_changed, write_info);
 
-        if (fseek(read_fp, cur_pos, SEEK_SET)) {
-            fclose(new_fp);
-            fclose(read_fp);
-            return -1;
-        }
-
-        while ((ret = fread(buf, 1, sizeof(buf), read_fp)) > 0 &&
-                           (cur_pos < end_pos)) {
-
-            if ((fwrite(buf, 1, ret, new_fp)) < ret) {
-                printf("error writing to file %s\n", filename);
-                fclose(new_fp);
-                fclose(read_fp);
-                return -1;
-            }
-
-            if( write_info != NULL) {
-                write_info->pct_done = (double) cur_pos / num_bytes;
-            }
+        fclose(read_fp);
 
-            cur_pos += ret;
+        if (copied < 0) {
+            printf("error writing to file %s\n", filename);
+            io_output_close(output);
+            return -1;
         }
 
-        fclose(read_fp);
+        out_pos += copied;
     }
 
     if( write_info != NULL) {
@@ -502,13 +869,16 @@ wav_merge_files(char *filename,
         write_info->cur_filename = NULL;
     }
 
-    fclose(new_fp);
+    if (!io_output_close(output)) {
+        printf("error writing to file %s\n", filename);
+        return -1;
+    }
 
     if( write_info != NULL) {
         write_info->pct_done = 1.0;
     }
 
-    return ret;
+    return 0;
 }
 
 
@@ -0,0 +1,846 @@
+/* wavbreaker - A tool to split a wave file up into multiple waves.
+ * Copyright (C) 2022 Thomas Perl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* for pread(), pwrite(), fileno(), fstat(), posix_fadvise(), fallocate() and copy_file_range() */
+#define _GNU_SOURCE
+
+#include <config.h>
+
+#include "io_engine.h"
+
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#if defined(G_OS_WIN32)
+#include <io.h>
+#else
+#include <sys/statvfs.h>
+#endif
+
+#if defined(HAVE_LIBURING)
+#include <liburing.h>
+#endif
+
+#if defined(HAVE_SENDFILE)
+#include <sys/sendfile.h>
+#endif
+
+#if defined(HAVE_FICLONERANGE)
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+
+/* Size of a single in-kernel copy request, so that progress can be reported in between */
+#define IO_ENGINE_KERNEL_COPY_SIZE (16 * IO_ENGINE_CHUNK_SIZE)
+
+/* Size of a single write request of a buffered copy, and of the stdio buffer of output files */
+#define IO_ENGINE_WRITE_CHUNK_SIZE (4 * IO_ENGINE_CHUNK_SIZE)
+
+/* Ways of copying in the kernel, tried in this order until one is supported for the files */
+typedef enum {
+#if defined(HAVE_COPY_FILE_RANGE)
+    IO_KERNEL_COPY_FILE_RANGE,
+#endif
+#if defined(HAVE_SENDFILE)
+    IO_KERNEL_COPY_SENDFILE,
+#endif
+    IO_KERNEL_COPY_NONE,
+} IoKernelCopy;
+
+typedef enum {
+    IO_SLOT_IDLE = 0,
+    IO_SLOT_READING,
+    IO_SLOT_READ,
+    IO_SLOT_WRITING,
+    IO_SLOT_WRITTEN,
+    IO_SLOT_FAILED,
+} IoSlotState;
+
+typedef struct {
+    IoSlotState state;
+    unsigned char *buf;
+
+    // position of buf[0] in the input file
+    uint64_t offset;
+
+    size_t length;
+    size_t filled;
+    size_t written;
+} IoSlot;
+
+/**
+ * A queue of chunk-sized slots that are cycled through in order of the
+ * input file. Each slot has at most one request in flight.
+ **/
+typedef struct {
+    int in_fd;
+    uint64_t in_offset;
+    int out_fd;
+    uint64_t out_offset;
+
+    // next chunk to be read, and end of the range to be read
+    uint64_t next_offset;
+    uint64_t end_offset;
+
+    size_t chunk_size;
+
+    IoSlot slots[IO_ENGINE_QUEUE_DEPTH];
+    guint num_slots;
+
+#if defined(HAVE_LIBURING)
+    gboolean use_uring;
+    struct io_uring ring;
+    guint in_flight;
+#endif /* HAVE_LIBURING */
+} IoQueue;
+
+struct IoOutputFile_ {
+    FILE *fp;
+    char *buf;
+
+    // space was reserved beyond the end of the file, to be released when closing
+    gboolean preallocated;
+};
+
+struct IoReadStream_ {
+    IoQueue queue;
+
+    // slot that is returned next, and slot whose data the caller holds (if any)
+    guint head;
+    IoSlot *held;
+};
+
+#if defined(G_OS_WIN32)
+/* there is no pread()/pwrite(), so the seek and read/write must not be interrupted */
+static GMutex
+g_io_seek_mutex;
+#endif /* G_OS_WIN32 */
+
+static gssize
+io_pread_fd(int fd, void *buf, size_t count, uint64_t offset)
+{
+#if defined(G_OS_WIN32)
+    gssize ret = -1;
+
+    g_mutex_lock(&g_io_seek_mutex);
+    if (_lseeki64(fd, offset, SEEK_SET) >= 0) {
+        ret = _read(fd, buf, count);
+    }
+    g_mutex_unlock(&g_io_seek_mutex);
+
+    return ret;
+#else
+    gssize ret;
+
+    do {
+        ret = pread(fd, buf, count, offset);
+    } while (ret < 0 && errno == EINTR);
+
+    return ret;
+#endif /* G_OS_WIN32 */
+}
+
+static gssize
+io_pwrite_fd(int fd, const void *buf, size_t count, uint64_t offset)
+{
+#if defined(G_OS_WIN32)
+    gssize ret = -1;
+
+    g_mutex_lock(&g_io_seek_mutex);
+    if (_lseeki64(fd, offset, SEEK_SET) >= 0) {
+        ret = _write(fd, buf, count);
+    }
+    g_mutex_unlock(&g_io_seek_mutex);
+
+    return ret;
+#else
+    gssize ret;
+
+    do {
+        ret = pwrite(fd, buf, count, offset);
+    } while (ret < 0 && errno == EINTR);
+
+    return ret;
+#endif /* G_OS_WIN32 */
+}
+
+gssize
+io_pread(FILE *fp, void *buf, size_t count, uint64_t offset)
+{
+    return io_pread_fd(fileno(fp), buf, count, offset);
+}
+
+gssize
+io_pwrite(FILE *fp, const void *buf, size_t count, uint64_t offset)
+{
+    return io_pwrite_fd(fileno(fp), buf, count, offset);
+}
+
+static void
+io_queue_init(IoQueue *q, FILE *in_fp, uint64_t in_offset, uint64_t length, FILE *out_fp, uint64_t out_offset)
+{
+    memset(q, 0, sizeof(*q));
+
+    q->in_fd = fileno(in_fp);
+    q->in_offset = in_offset;
+    q->out_fd = (out_fp != NULL) ? fileno(out_fp) : -1;
+    q->out_offset = out_offset;
+
+    q->next_offset = in_offset;
+    q->end_offset = in_offset + length;
+
+    q->chunk_size = (out_fp != NULL) ? IO_ENGINE_WRITE_CHUNK_SIZE : IO_ENGINE_CHUNK_SIZE;
+    q->num_slots = 1;
+
+#if defined(HAVE_LIBURING)
+    int ret = io_uring_queue_init(IO_ENGINE_QUEUE_DEPTH, &q->ring, 0);
+    if (ret == 0) {
+        q->use_uring = TRUE;
+        q->num_slots = IO_ENGINE_QUEUE_DEPTH;
+    } else {
+        g_debug("io_uring not available (%s), using blocking I/O", strerror(-ret));
+    }
+#endif /* HAVE_LIBURING */
+
+    for (guint i=0; i<q->num_slots; ++i) {
+        q->slots[i].buf = g_malloc(q->chunk_size);
+    }
+
+#if defined(POSIX_FADV_SEQUENTIAL)
+    posix_fadvise(q->in_fd, in_offset, length, POSIX_FADV_SEQUENTIAL);
+#endif /* POSIX_FADV_SEQUENTIAL */
+}
+
+#if defined(HAVE_LIBURING)
+static void
+io_queue_prepare_uring(IoQueue *q, IoSlot *slot)
+{
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&q->ring);
+
+    // each slot has at most one request in flight, so this should never happen
+    g_assert(sqe != NULL);
+
+    if (slot->state == IO_SLOT_READING) {
+        io_uring_prep_read(sqe, q->in_fd, slot->buf + slot->filled, slot->length - slot->filled,
+                slot->offset + slot->filled);
+    } else {
+        io_uring_prep_write(sqe, q->out_fd, slot->buf + slot->written, slot->filled - slot->written,
+                q->out_offset + (slot->offset - q->in_offset) + slot->written);
+    }
+
+    io_uring_sqe_set_data(sqe, slot);
+    q->in_flight++;
+}
+#endif /* HAVE_LIBURING */
+
+static void
+io_queue_submit(IoQueue *q, IoSlot *slot)
+{
+#if defined(HAVE_LIBURING)
+    if (q->use_uring) {
+        // will be submitted in batch by io_queue_process()
+        io_queue_prepare_uring(q, slot);
+    }
+#endif /* HAVE_LIBURING */
+
+    // with blocking I/O, the request is carried out in io_queue_process()
+}
+
+static void
+io_queue_start_read(IoQueue *q, IoSlot *slot)
+{
+    if (q->next_offset >= q->end_offset) {
+        slot->state = IO_SLOT_IDLE;
+        return;
+    }
+
+    slot->state = IO_SLOT_READING;
+    slot->offset = q->next_offset;
+    slot->length = MIN(q->end_offset - q->next_offset, q->chunk_size);
+
+    if (q->out_fd != -1) {
+        // end the chunk at a multiple of the chunk size in the output file, so that writes are aligned
+        uint64_t out_position = q->out_offset + (q->next_offset - q->in_offset);
+        slot->length = MIN(slot->length, q->chunk_size - out_position % q->chunk_size);
+    }
+    slot->filled = 0;
+    slot->written = 0;
+
+    q->next_offset += slot->length;
+
+    io_queue_submit(q, slot);
+}
+
+static void
+io_queue_start_write(IoQueue *q, IoSlot *slot)
+{
+    slot->state = IO_SLOT_WRITING;
+    slot->written = 0;
+
+    io_queue_submit(q, slot);
+}
+
+/* Updates the slot state after a (possibly partial) read or write */
+static void
+io_queue_complete(IoQueue *q, IoSlot *slot, gssize result)
+{
+    if (result < 0) {
+        g_warning("I/O error: %s", strerror(errno));
+        slot->state = IO_SLOT_FAILED;
+    } else if (slot->state == IO_SLOT_READING) {
+        slot->filled += result;
+
+        if (result == 0) {
+            // input ended early, don't read any further
+            q->end_offset = MIN(q->end_offset, slot->offset + slot->filled);
+            slot->state = IO_SLOT_READ;
+        } else if (slot->filled == slot->length) {
+            slot->state = IO_SLOT_READ;
+        }
+    } else if (slot->state == IO_SLOT_WRITING) {
+        slot->written += result;
+
+        if (result == 0) {
+            g_warning("I/O error: Short write");
+            slot->state = IO_SLOT_FAILED;
+        } else if (slot->written == slot->filled) {
+            slot->state = IO_SLOT_WRITTEN;
+        }
+    }
+}
+
+/* Waits for (or carries out) at least one request, returns FALSE on error */
+static gboolean
+io_queue_process(IoQueue *q)
+{
+#if defined(HAVE_LIBURING)
+    if (q->use_uring) {
+        struct io_uring_cqe *cqe;
+
+        int ret = io_uring_submit_and_wait(&q->ring, 1);
+        if (ret < 0 && ret != -EINTR) {
+            g_warning("Could not submit I/O requests: %s", strerror(-ret));
+            return FALSE;
+        }
+
+        ret = io_uring_peek_cqe(&q->ring, &cqe);
+        if (ret == -EAGAIN) {
+            return TRUE;
+        } else if (ret < 0) {
+            g_warning("Could not get I/O completion: %s", strerror(-ret));
+            return FALSE;
+        }
+
+        IoSlot *slot = io_uring_cqe_get_data(cqe);
+        int result = cqe->res;
+
+        io_uring_cqe_seen(&q->ring, cqe);
+        q->in_flight--;
+
+        if (result == -EINTR || result == -EAGAIN) {
+            // retry the same request
+            io_queue_prepare_uring(q, slot);
+            return TRUE;
+        }
+
+        if (result < 0) {
+            errno = -result;
+        }
+
+        io_queue_complete(q, slot, result);
+
+        if (slot->state == IO_SLOT_READING || slot->state == IO_SLOT_WRITING) {
+            // partial read or write, request the rest
+            io_queue_prepare_uring(q, slot);
+        }
+
+        return TRUE;
+    }
+#endif /* HAVE_LIBURING */
+
+    for (guint i=0; i<q->num_slots; ++i) {
+        IoSlot *slot = &q->slots[i];
+
+        while (slot->state == IO_SLOT_READING) {
+            io_queue_complete(q, slot, io_pread_fd(q->in_fd, slot->buf + slot->filled,
+                        slot->length - slot->filled, slot->offset + slot->filled));
+        }
+
+        while (slot->state == IO_SLOT_WRITING) {
+            io_queue_complete(q, slot, io_pwrite_fd(q->out_fd, slot->buf + slot->written,
+                        slot->filled - slot->written, q->out_offset + (slot->offset - q->in_offset) + slot->written));
+        }
+    }
+
+    return TRUE;
+}
+
+static gboolean
+io_queue_busy(IoQueue *q)
+{
+    for (guint i=0; i<q->num_slots; ++i) {
+        if (q->slots[i].state == IO_SLOT_READING || q->slots[i].state == IO_SLOT_WRITING) {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+static void
+io_queue_clear(IoQueue *q)
+{
+#if defined(HAVE_LIBURING)
+    if (q->use_uring) {
+        // buffers must not be freed while the kernel might still access them
+        while (q->in_flight > 0) {
+            struct io_uring_cqe *cqe;
+
+            int ret = io_uring_submit_and_wait(&q->ring, 1);
+            if (ret < 0 && ret != -EINTR) {
+                // leak the buffers instead of risking memory corruption
+                g_warning("Could not wait for outstanding I/O requests: %s", strerror(-ret));
+                return;
+            }
+
+            while (io_uring_peek_cqe(&q->ring, &cqe) == 0) {
+                io_uring_cqe_seen(&q->ring, cqe);
+                q->in_flight--;
+            }
+        }
+
+        io_uring_queue_exit(&q->ring);
+    }
+#endif /* HAVE_LIBURING */
+
+    for (guint i=0; i<q->num_slots; ++i) {
+        g_free(q->slots[i].buf);
+    }
+}
+
+IoReadStream *
+io_read_stream_open(FILE *fp, uint64_t offset, uint64_t length)
+{
+    IoReadStream *stream = g_new0(IoReadStream, 1);
+
+    io_queue_init(&stream->queue, fp, offset, length, NULL, 0);
+
+    for (guint i=0; i<stream->queue.num_slots; ++i) {
+        io_queue_start_read(&stream->queue, &stream->queue.slots[i]);
+    }
+
+    return stream;
+}
+
+gssize
+io_read_stream_next(IoReadStream *stream, const unsigned char **data)
+{
+    IoQueue *q = &stream->queue;
+
+    if (stream->held != NULL) {
+        // the caller is done with this chunk, re-use the slot for read-ahead
+        io_queue_start_read(q, g_steal_pointer(&stream->held));
+    }
+
+    IoSlot *slot = &q->slots[stream->head];
+
+    while (slot->state == IO_SLOT_READING) {
+        if (!io_queue_process(q)) {
+            return -1;
+        }
+    }
+
+    if (slot->state == IO_SLOT_FAILED) {
+        return -1;
+    } else if (slot->state == IO_SLOT_IDLE) {
+        return 0;
+    }
+
+    *data = slot->buf;
+    stream->held = slot;
+    stream->head = (stream->head + 1) % q->num_slots;
+
+    return slot->filled;
+}
+
+void
+io_read_stream_close(IoReadStream *stream)
+{
+    io_queue_clear(&stream->queue);
+    g_free(stream);
+}
+
+static gssize
+io_kernel_copy_chunk(IoKernelCopy method, int in_fd, uint64_t in_offset, int out_fd, uint64_t out_offset, size_t count)
+{
+    gssize ret = -1;
+
+    switch (method) {
+#if defined(HAVE_COPY_FILE_RANGE)
+        case IO_KERNEL_COPY_FILE_RANGE: {
+            /* can be a reflink or a server-side copy (e.g. NFS 4.2), depending on the file system */
+            loff_t in_off = in_offset;
+            loff_t out_off = out_offset;
+
+            do {
+                ret = copy_file_range(in_fd, &in_off, out_fd, &out_off, count, 0);
+            } while (ret < 0 && errno == EINTR);
+            break;
+        }
+#endif /* HAVE_COPY_FILE_RANGE */
+#if defined(HAVE_SENDFILE)
+        case IO_KERNEL_COPY_SENDFILE: {
+            /* sendfile() writes at the current position, which is restored afterwards */
+            off_t in_off = in_offset;
+            off_t position = lseek(out_fd, 0, SEEK_CUR);
+
+            if (position >= 0 && lseek(out_fd, out_offset, SEEK_SET) >= 0) {
+                do {
+                    ret = sendfile(out_fd, in_fd, &in_off, count);
+                } while (ret < 0 && errno == EINTR);
+
+                int saved_errno = errno;
+                lseek(out_fd, position, SEEK_SET);
+                errno = saved_errno;
+            }
+            break;
+        }
+#endif /* HAVE_SENDFILE */
+        default:
+            errno = ENOSYS;
+            break;
+    }
+
+    return ret;
+}
+
+static gboolean
+io_kernel_copy_unsupported(int err)
+{
+    /* not implemented, not between these file systems, or not for this type of file */
+    return (err == ENOSYS || err == EXDEV || err == EINVAL || err == EOPNOTSUPP);
+}
+
+typedef struct {
+    io_progress_func func;
+    void *user_data;
+
+    // bytes of the whole io_copy() done before the current part, and in total
+    uint64_t done;
+    uint64_t total;
+} IoCopyProgress;
+
+static void
+io_copy_progress_report(IoCopyProgress *progress, uint64_t copied)
+{
+    if (progress->func != NULL && progress->total > 0) {
+        progress->func((double)(progress->done + copied) / progress->total, progress->user_data);
+    }
+}
+
+static int64_t
+io_copy_data(FILE *in_fp, uint64_t in_offset, FILE *out_fp, uint64_t out_offset, uint64_t length,
+        IoCopyProgress *progress)
+{
+    IoQueue q;
+    uint64_t copied = 0;
+    gboolean failed = FALSE;
+
+    /* first try to let the kernel copy the data, without going through user space */
+    IoKernelCopy method = 0;
+    while (method != IO_KERNEL_COPY_NONE && copied < length) {
+        gssize ret = io_kernel_copy_chunk(method, fileno(in_fp), in_offset + copied,
+                fileno(out_fp), out_offset + copied, MIN(length - copied, IO_ENGINE_KERNEL_COPY_SIZE));
+
+        if (ret > 0) {
+            copied += ret;
+            io_copy_progress_report(progress, copied);
+        } else if (ret == 0) {
+            /* end of the input file */
+            return copied;
+        } else if (io_kernel_copy_unsupported(errno)) {
+            g_debug("In-kernel copy method %d not supported: %s", method, strerror(errno));
+            method++;
+        } else {
+            return -1;
+        }
+    }
+
+    if (copied == length) {
+        return copied;
+    }
+
+    /* buffered copy of the rest */
+    io_queue_init(&q, in_fp, in_offset + copied, length - copied, out_fp, out_offset + copied);
+
+    for (guint i=0; i<q.num_slots; ++i) {
+        io_queue_start_read(&q, &q.slots[i]);
+    }
+
+    while (!failed) {
+        for (guint i=0; i<q.num_slots; ++i) {
+            IoSlot *slot = &q.slots[i];
+
+            if (slot->state == IO_SLOT_READ) {
+                if (slot->filled > 0) {
+                    io_queue_start_write(&q, slot);
+                } else {
+                    slot->state = IO_SLOT_IDLE;
+                }
+            } else if (slot->state == IO_SLOT_WRITTEN) {
+                copied += slot->written;
+                io_copy_progress_report(progress, copied);
+
+                io_queue_start_read(&q, slot);
+            } else if (slot->state == IO_SLOT_FAILED) {
+                failed = TRUE;
+            }
+        }
+
+        if (failed || !io_queue_busy(&q)) {
+            break;
+        }
+
+        if (!io_queue_process(&q)) {
+            failed = TRUE;
+        }
+    }
+
+    io_queue_clear(&q);
+
+    return failed ? -1 : (int64_t)copied;
+}
+
+#if defined(HAVE_FICLONERANGE)
+static gboolean
+io_clone_range(FILE *in_fp, uint64_t in_offset, FILE *out_fp, uint64_t out_offset, uint64_t length)
+{
+    struct file_clone_range range = {
+        .src_fd = fileno(in_fp),
+        .src_offset = in_offset,
+        .src_length = length,
+        .dest_offset = out_offset,
+    };
+
+    if (ioctl(fileno(out_fp), FICLONERANGE, &range) != 0) {
+        g_debug("Cannot clone file range: %s", strerror(errno));
+        return FALSE;
+    }
+
+    return TRUE;
+}
+#endif /* HAVE_FICLONERANGE */
+
+uint32_t
+io_get_block_size(FILE *fp)
+{
+#if defined(G_OS_WIN32)
+    return 0;
+#else
+    struct stat st;
+
+    if (fstat(fileno(fp), &st) != 0 || st.st_blksize <= 0) {
+        return 0;
+    }
+
+    return st.st_blksize;
+#endif /* G_OS_WIN32 */
+}
+
+int64_t
+io_copy(FILE *in_fp, uint64_t in_offset, FILE *out_fp, uint64_t out_offset, uint64_t length,
+        io_progress_func report_progress, void *report_progress_user_data)
+{
+    IoCopyProgress progress = { report_progress, report_progress_user_data, 0, length };
+
+    if (fflush(out_fp) != 0) {
+        return -1;
+    }
+
+#if defined(HAVE_FICLONERANGE)
+    /**
+     * If the range starts at the same offset within a file system block in both files,
+     * the whole blocks in between can be shared (copy-on-write) instead of copied, and
+     * only the partial blocks at the start and the end have to be copied.
+     **/
+    uint32_t block_size = io_get_block_size(out_fp);
+    struct stat in_st, out_st;
+
+    if (block_size > 0 && in_offset % block_size == out_offset % block_size &&
+            fstat(fileno(in_fp), &in_st) == 0 && fstat(fileno(out_fp), &out_st) == 0 &&
+            in_st.st_dev == out_st.st_dev) {
+        uint64_t head = (block_size - in_offset % block_size) % block_size;
+        uint64_t middle = (length > head) ? (length - head) / block_size * block_size : 0;
+
+        if (middle > 0) {
+            int64_t ret = io_copy_data(in_fp, in_offset, out_fp, out_offset, head, &progress);
+            if (ret != (int64_t)head) {
+                return ret;
+            }
+            progress.done += head;
+
+            if (io_clone_range(in_fp, in_offset + head, out_fp, out_offset + head, middle)) {
+                progress.done += middle;
+                io_copy_progress_report(&progress, 0);
+
+                ret = io_copy_data(in_fp, in_offset + head + middle, out_fp, out_offset + head + middle,
+                        length - head - middle, &progress);
+
+                return (ret < 0) ? -1 : (int64_t)(head + middle + ret);
+            }
+
+            /* not supported by the file system, copy the rest */
+            ret = io_copy_data(in_fp, in_offset + head, out_fp, out_offset + head, length - head, &progress);
+
+            return (ret < 0) ? -1 : (int64_t)(head + ret);
+        }
+    }
+#endif /* HAVE_FICLONERANGE */
+
+    return io_copy_data(in_fp, in_offset, out_fp, out_offset, length, &progress);
+}
+
+IoOutputFile *
+io_output_open(const char *filename, uint64_t expected_size)
+{
+    FILE *fp = fopen(filename, "wb");
+
+    if (fp == NULL) {
+        return NULL;
+    }
+
+    IoOutputFile *out = g_new0(IoOutputFile, 1);
+
+    out->fp = fp;
+    out->buf = g_malloc(IO_ENGINE_WRITE_CHUNK_SIZE);
+    setvbuf(fp, out->buf, _IOFBF, IO_ENGINE_WRITE_CHUNK_SIZE);
+
+#if defined(HAVE_FALLOCATE)
+    if (expected_size > 0) {
+        /* reserve the space in one go, but keep the file size, so that a wrong estimate does no harm */
+        int ret;
+
+        do {
+            ret = fallocate(fileno(fp), FALLOC_FL_KEEP_SIZE, 0, expected_size);
+        } while (ret != 0 && errno == EINTR);
+
+        if (ret == 0) {
+            out->preallocated = TRUE;
+        } else {
+            g_debug("Cannot preallocate %" G_GUINT64_FORMAT " bytes for %s: %s", expected_size, filename, strerror(errno));
+        }
+    }
+#endif /* HAVE_FALLOCATE */
+
+    return out;
+}
+
+FILE *
+io_output_get_fp(IoOutputFile *out)
+{
+    return out->fp;
+}
+
+gboolean
+io_output_close(IoOutputFile *out)
+{
+    gboolean result = (fflush(out->fp) == 0);
+
+#if defined(HAVE_FALLOCATE)
+    if (out->preallocated) {
+        /* truncating to the current size releases the reserved blocks that were not written */
+        struct stat st;
+
+        if (fstat(fileno(out->fp), &st) != 0 || ftruncate(fileno(out->fp), st.st_size) != 0) {
+            g_debug("Cannot release preallocated space: %s", strerror(errno));
+        }
+    }
+#endif /* HAVE_FALLOCATE */
+
+    if (fclose(out->fp) != 0) {
+        result = FALSE;
+    }
+
+    g_free(out->buf);
+    g_free(out);
+
+    return result;
+}
+
+uint32_t
+io_get_clone_block_size(FILE *fp, const char *path)
+{
+#if defined(HAVE_FICLONERANGE)
+    struct stat in_st, out_st;
+
+    /* blocks can only be shared within one file system */
+    if (fstat(fileno(fp), &in_st) != 0 || stat(path, &out_st) != 0 ||
+            in_st.st_dev != out_st.st_dev || out_st.st_blksize <= 0 ||
+            in_st.st_size < out_st.st_blksize) {
+        return 0;
+    }
+
+    gchar *tmp_filename = g_build_filename(path, ".wavbreaker-clone-XXXXXX", NULL);
+    int fd = mkstemp(tmp_filename);
+
+    if (fd == -1) {
+        g_free(tmp_filename);
+        return 0;
+    }
+
+    struct file_clone_range range = {
+        .src_fd = fileno(fp),
+        .src_offset = 0,
+        .src_length = out_st.st_blksize,
+        .dest_offset = 0,
+    };
+
+    gboolean supported = (ioctl(fd, FICLONERANGE, &range) == 0);
+    if (!supported) {
+        g_debug("Cannot clone blocks into %s: %s", path, strerror(errno));
+    }
+
+    close(fd);
+    unlink(tmp_filename);
+    g_free(tmp_filename);
+
+    return supported ? out_st.st_blksize : 0;
+#else
+    return 0;
+#endif /* HAVE_FICLONERANGE */
+}
+
+int64_t
+io_get_free_space(const char *path)
+{
+#if defined(G_OS_WIN32)
+    return -1;
+#else
+    struct statvfs st;
+
+    if (statvfs(path, &st) != 0) {
+        return -1;
+    }
+
+    /* space available to unprivileged users */
+    return (int64_t)st.f_bavail * st.f_frsize;
+#endif /* G_OS_WIN32 */
+}
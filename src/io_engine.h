@@ -0,0 +1,121 @@
+/* wavbreaker - A tool to split a wave file up into multiple waves.
+ * Copyright (C) 2022 Thomas Perl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#pragma once
+
+#include <glib.h>
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * File I/O with several large requests in flight at once. If built with
+ * liburing (and the running kernel supports it), reads and writes are
+ * submitted asynchronously via io_uring, otherwise blocking pread() and
+ * pwrite() calls are used.
+ *
+ * All functions work on the file descriptor of the given stdio stream, and
+ * neither use nor update its current position.
+ **/
+
+/* Size of a single read or write request */
+#define IO_ENGINE_CHUNK_SIZE (1024 * 1024)
+
+/* Maximum number of requests in flight */
+#define IO_ENGINE_QUEUE_DEPTH 4
+
+typedef void (*io_progress_func)(double progress, void *user_data);
+
+typedef struct IoReadStream_ IoReadStream;
+typedef struct IoOutputFile_ IoOutputFile;
+
+/* Positional read/write (retrying on EINTR), also available on Windows */
+gssize
+io_pread(FILE *fp, void *buf, size_t count, uint64_t offset);
+
+gssize
+io_pwrite(FILE *fp, const void *buf, size_t count, uint64_t offset);
+
+/**
+ * Sequential read of up to length bytes from fp starting at offset, with
+ * the following chunks being read ahead in the background.
+ *
+ * io_read_stream_next() sets *data to the next chunk and returns its size,
+ * 0 at the end or -1 on error. The data is only valid until the next call.
+ **/
+IoReadStream *
+io_read_stream_open(FILE *fp, uint64_t offset, uint64_t length);
+
+gssize
+io_read_stream_next(IoReadStream *stream, const unsigned char **data);
+
+void
+io_read_stream_close(IoReadStream *stream);
+
+/* Block size of the file system containing fp (as a hint for aligning data), or 0 if unknown */
+uint32_t
+io_get_block_size(FILE *fp);
+
+/**
+ * Copy up to length bytes from in_fp at in_offset to out_fp at out_offset
+ * (out_fp is flushed first, so data written to it via stdio is preserved).
+ * Returns the number of bytes copied (less than length only if in_fp ends
+ * early) or -1 on error. report_progress can be NULL.
+ *
+ * If both offsets are at the same position within a file system block, the
+ * whole blocks in between are cloned (shared copy-on-write) where supported,
+ * e.g. on Btrfs and XFS; see io_get_block_size().
+ **/
+int64_t
+io_copy(FILE *in_fp, uint64_t in_offset, FILE *out_fp, uint64_t out_offset, uint64_t length,
+        io_progress_func report_progress, void *report_progress_user_data);
+
+/**
+ * Output file for writing a split track. Data written via stdio to the
+ * stream returned by io_output_get_fp() is buffered in large chunks.
+ *
+ * If expected_size is known (non-zero), the space is reserved up front
+ * where supported, so that the file system can allocate the file in one
+ * piece instead of growing it with every write. Reserved space that was
+ * not written is released by io_output_close(), which returns FALSE if
+ * the buffered data could not be written.
+ *
+ * io_output_open() returns NULL (with errno set) if the file cannot be created.
+ **/
+IoOutputFile *
+io_output_open(const char *filename, uint64_t expected_size);
+
+FILE *
+io_output_get_fp(IoOutputFile *out);
+
+gboolean
+io_output_close(IoOutputFile *out);
+
+/**
+ * Block size of the file system if io_copy() can clone whole blocks from fp
+ * into files created in the directory path, or 0 if they have to be copied.
+ * Support is confirmed by cloning the first block of fp into a temporary file
+ * in path, as not all file systems can clone (e.g. ext4 can't).
+ **/
+uint32_t
+io_get_clone_block_size(FILE *fp, const char *path);
+
+/* Free space in bytes of the file system containing path, or -1 if unknown */
+int64_t
+io_get_free_space(const char *path);
@@ -0,0 +1,175 @@
+/* wavbreaker - A tool to split a wave file up into multiple waves.
+ * Copyright (C) 2022 Thomas Perl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* for mmap(), mkstemp(), posix_fallocate() and unlink() */
+#define _GNU_SOURCE
+
+#include "pcm_cache.h"
+#include "io_engine.h"
+
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+
+#if !defined(G_OS_WIN32)
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+struct PcmCache_ {
+    int fd;
+    unsigned char *data;
+    uint64_t size;
+    size_t region_size;
+
+    // one bit per region, set once the region has been filled
+    guint *valid;
+};
+
+PcmCache *
+pcm_cache_new(uint64_t size, size_t region_size)
+{
+#if defined(G_OS_WIN32)
+    /* files that are open can't be removed, and there's no shared file mapping via mmap() */
+    return NULL;
+#else
+    if (size == 0 || region_size == 0 || size > G_MAXSIZE) {
+        return NULL;
+    }
+
+    /* on disk, as the temporary directory is often in RAM (and decoded files can be large) */
+    gchar *dirname = g_build_filename(g_get_user_cache_dir(), "wavbreaker", "pcm", NULL);
+    if (g_mkdir_with_parents(dirname, 0700) != 0) {
+        g_debug("Could not create PCM cache directory %s", dirname);
+        g_free(dirname);
+        return NULL;
+    }
+
+    /* space is reserved region by region, but the whole file should fit */
+    int64_t free_space = io_get_free_space(dirname);
+    if (free_space >= 0 && (uint64_t)free_space < size) {
+        g_debug("Not enough free space for %" G_GUINT64_FORMAT " bytes of PCM cache in %s", size, dirname);
+        g_free(dirname);
+        return NULL;
+    }
+
+    gchar *filename = g_build_filename(dirname, "pcm-XXXXXX", NULL);
+    g_free(dirname);
+
+    int fd = mkstemp(filename);
+    if (fd == -1) {
+        g_debug("Could not create PCM cache file %s: %s", filename, strerror(errno));
+        g_free(filename);
+        return NULL;
+    }
+
+    /* the file stays around only as long as it is open (and mapped) */
+    unlink(filename);
+    g_free(filename);
+
+    /* sparse, the blocks are allocated by pcm_cache_reserve_region() */
+    if (ftruncate(fd, size) != 0) {
+        g_debug("Could not resize PCM cache to %" G_GUINT64_FORMAT " bytes: %s", size, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (data == MAP_FAILED) {
+        g_debug("Could not map PCM cache: %s", strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    PcmCache *cache = g_new0(PcmCache, 1);
+
+    cache->fd = fd;
+    cache->data = data;
+    cache->size = size;
+    cache->region_size = region_size;
+
+    uint64_t num_regions = (size + region_size - 1) / region_size;
+    cache->valid = g_new0(guint, (num_regions + 31) / 32);
+
+    return cache;
+#endif /* G_OS_WIN32 */
+}
+
+uint64_t
+pcm_cache_get_size(PcmCache *cache)
+{
+    return cache->size;
+}
+
+size_t
+pcm_cache_get_region_size(PcmCache *cache)
+{
+    return cache->region_size;
+}
+
+unsigned char *
+pcm_cache_get_data(PcmCache *cache, uint64_t offset)
+{
+    return cache->data + offset;
+}
+
+gboolean
+pcm_cache_reserve_region(PcmCache *cache, uint64_t region)
+{
+#if defined(G_OS_WIN32)
+    return FALSE;
+#else
+    uint64_t offset = region * cache->region_size;
+    uint64_t length = MIN(cache->region_size, cache->size - offset);
+
+    /* writing to an unallocated block of the mapping would crash if the disk is full */
+    int ret = posix_fallocate(cache->fd, offset, length);
+    if (ret != 0) {
+        g_debug("Could not allocate PCM cache region %" G_GUINT64_FORMAT ": %s", region, strerror(ret));
+        return FALSE;
+    }
+
+    return TRUE;
+#endif /* G_OS_WIN32 */
+}
+
+gboolean
+pcm_cache_is_valid(PcmCache *cache, uint64_t region)
+{
+    return (g_atomic_int_get(&cache->valid[region / 32]) & (1u << (region % 32))) != 0;
+}
+
+void
+pcm_cache_set_valid(PcmCache *cache, uint64_t region)
+{
+    /* atomic operations are full barriers, so the data is visible to threads that see the bit */
+    g_atomic_int_or(&cache->valid[region / 32], 1u << (region % 32));
+}
+
+void
+pcm_cache_free(PcmCache *cache)
+{
+#if !defined(G_OS_WIN32)
+    munmap(cache->data, cache->size);
+    close(cache->fd);
+#endif /* G_OS_WIN32 */
+
+    g_free(cache->valid);
+    g_free(cache);
+}
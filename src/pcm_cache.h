@@ -0,0 +1,63 @@
+/* wavbreaker - A tool to split a wave file up into multiple waves.
+ * Copyright (C) 2022 Thomas Perl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#pragma once
+
+#include <glib.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Temporary file for decoded samples in the user's cache directory,
+ * memory-mapped and divided into regions of region_size bytes. Regions are
+ * reserved on disk with pcm_cache_reserve_region(), filled by the caller via
+ * the pointer from pcm_cache_get_data() and then marked as valid, afterwards
+ * they can be read directly from the mapping. The file is removed when the
+ * cache is freed (or when the process exits).
+ *
+ * Marking a region valid and checking it can be done from multiple threads.
+ **/
+
+typedef struct PcmCache_ PcmCache;
+
+/* Returns NULL if the file cannot be created or mapped, or if there is not enough free space for it */
+PcmCache *
+pcm_cache_new(uint64_t size, size_t region_size);
+
+uint64_t
+pcm_cache_get_size(PcmCache *cache);
+
+size_t
+pcm_cache_get_region_size(PcmCache *cache);
+
+unsigned char *
+pcm_cache_get_data(PcmCache *cache, uint64_t offset);
+
+/* Allocates the disk space of a region, must succeed before the region is written to */
+gboolean
+pcm_cache_reserve_region(PcmCache *cache, uint64_t region);
+
+gboolean
+pcm_cache_is_valid(PcmCache *cache, uint64_t region);
+
+void
+pcm_cache_set_valid(PcmCache *cache, uint64_t region);
+
+void
+pcm_cache_free(PcmCache *cache);
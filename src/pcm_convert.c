@@ -0,0 +1,635 @@
+/* wavbreaker - A tool to split a wave file up into multiple waves.
+ * Copyright (C) 2022 Thomas Perl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "pcm_convert.h"
+
+#include <string.h>
+#include <glib.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PCM_CONVERT_X86_SIMD
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#define PCM_CONVERT_NEON
+#include <arm_neon.h>
+#endif
+
+/**
+ * Each sample layout provides a load function returning the MSB-aligned
+ * int32_t value of a single sample. The kernels below are instantiated
+ * for mono, stereo and any channel count, with the channel loop unrolled
+ * for the common cases so that the compiler can vectorize the frame loop.
+ **/
+
+static inline int32_t
+load_u8(const unsigned char *p)
+{
+    return (int32_t)((uint32_t)(p[0] ^ 0x80) << 24);
+}
+
+static inline int32_t
+load_s16le(const unsigned char *p)
+{
+    return (int32_t)((uint32_t)p[0] << 16 | (uint32_t)p[1] << 24);
+}
+
+static inline int32_t
+load_s16be(const unsigned char *p)
+{
+    return (int32_t)((uint32_t)p[1] << 16 | (uint32_t)p[0] << 24);
+}
+
+static inline int32_t
+load_s24le(const unsigned char *p)
+{
+    return (int32_t)((uint32_t)p[0] << 8 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 24);
+}
+
+static inline int32_t
+load_s32le(const unsigned char *p)
+{
+    return (int32_t)((uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+}
+
+static inline float
+load_f32le_f32(const unsigned char *p)
+{
+    uint32_t bits = (uint32_t)load_s32le(p);
+    float result;
+    memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+static inline int32_t
+load_f32le(const unsigned char *p)
+{
+    float value = load_f32le_f32(p) * 2147483648.f;
+
+    if (value >= 2147483647.f) {
+        return INT32_MAX;
+    } else if (value <= -2147483648.f) {
+        return INT32_MIN;
+    }
+
+    return (int32_t)value;
+}
+
+#define S32_TO_F32(x) ((float)(x) * (1.f / 2147483648.f))
+
+#define DEFINE_KERNELS(layout, bytes, load_s32, load_f32) \
+static void \
+layout ## _to_s32_mono(const unsigned char *src, int32_t *const dst[], size_t num_frames, unsigned int channels) \
+{ \
+    int32_t *restrict out = dst[0]; \
+    for (size_t i=0; i<num_frames; ++i) { \
+        out[i] = load_s32(src + i * (bytes)); \
+    } \
+} \
+\
+static void \
+layout ## _to_s32_stereo(const unsigned char *src, int32_t *const dst[], size_t num_frames, unsigned int channels) \
+{ \
+    int32_t *restrict left = dst[0]; \
+    int32_t *restrict right = dst[1]; \
+    for (size_t i=0; i<num_frames; ++i) { \
+        left[i] = load_s32(src + i * 2 * (bytes)); \
+        right[i] = load_s32(src + i * 2 * (bytes) + (bytes)); \
+    } \
+} \
+\
+static void \
+layout ## _to_s32_multi(const unsigned char *src, int32_t *const dst[], size_t num_frames, unsigned int channels) \
+{ \
+    for (unsigned int ch=0; ch<channels; ++ch) { \
+        int32_t *restrict out = dst[ch]; \
+        for (size_t i=0; i<num_frames; ++i) { \
+            out[i] = load_s32(src + (i * channels + ch) * (bytes)); \
+        } \
+    } \
+} \
+\
+static void \
+layout ## _to_f32_mono(const unsigned char *src, float *const dst[], size_t num_frames, unsigned int channels) \
+{ \
+    float *restrict out = dst[0]; \
+    for (size_t i=0; i<num_frames; ++i) { \
+        out[i] = load_f32(src + i * (bytes)); \
+    } \
+} \
+\
+static void \
+layout ## _to_f32_stereo(const unsigned char *src, float *const dst[], size_t num_frames, unsigned int channels) \
+{ \
+    float *restrict left = dst[0]; \
+    float *restrict right = dst[1]; \
+    for (size_t i=0; i<num_frames; ++i) { \
+        left[i] = load_f32(src + i * 2 * (bytes)); \
+        right[i] = load_f32(src + i * 2 * (bytes) + (bytes)); \
+    } \
+} \
+\
+static void \
+layout ## _to_f32_multi(const unsigned char *src, float *const dst[], size_t num_frames, unsigned int channels) \
+{ \
+    for (unsigned int ch=0; ch<channels; ++ch) { \
+        float *restrict out = dst[ch]; \
+        for (size_t i=0; i<num_frames; ++i) { \
+            out[i] = load_f32(src + (i * channels + ch) * (bytes)); \
+        } \
+    } \
+}
+
+#define DEFINE_LOAD_AS_F32(load_s32) \
+static inline float \
+load_s32 ## _as_f32(const unsigned char *p) \
+{ \
+    return S32_TO_F32(load_s32(p)); \
+}
+
+DEFINE_LOAD_AS_F32(load_u8)
+DEFINE_LOAD_AS_F32(load_s16le)
+DEFINE_LOAD_AS_F32(load_s16be)
+DEFINE_LOAD_AS_F32(load_s24le)
+DEFINE_LOAD_AS_F32(load_s32le)
+
+DEFINE_KERNELS(u8, 1, load_u8, load_u8_as_f32)
+DEFINE_KERNELS(s16le, 2, load_s16le, load_s16le_as_f32)
+DEFINE_KERNELS(s16be, 2, load_s16be, load_s16be_as_f32)
+DEFINE_KERNELS(s24le, 3, load_s24le, load_s24le_as_f32)
+DEFINE_KERNELS(s32le, 4, load_s32le, load_s32le_as_f32)
+DEFINE_KERNELS(f32le, 4, load_f32le, load_f32le_f32)
+
+/**
+ * Peak detection: the vector kernels compute the lane-wise minimum and
+ * maximum over whole vectors of interleaved samples. With one or two
+ * channels, each lane always holds samples of the same channel, so only
+ * the lanes of the first channel are combined at the end. Kernels are
+ * selected at runtime, like for pcm_convert_swap16() below.
+ **/
+
+enum PeakLanes {
+    PEAK_LANES_U8 = 0,
+    PEAK_LANES_S16,
+    PEAK_LANES_S16_SWAP,
+    PEAK_LANES_S32,
+    PEAK_LANES_F32,
+    PEAK_LANES_COUNT,
+
+    // for layouts without vector kernels
+    PEAK_LANES_NONE = PEAK_LANES_COUNT,
+};
+
+/* Largest vector size in bytes (AVX-512) */
+#define PEAK_MAX_WIDTH 64
+
+/* stores the lane-wise minimum and maximum of num_vectors (at least 1) vectors to min and max */
+typedef void (*peak_lanes_func)(const unsigned char *src, size_t num_vectors, unsigned char *min, unsigned char *max);
+
+typedef struct {
+    // vector size in bytes, 0 if there are no vector kernels
+    size_t width;
+    peak_lanes_func lanes[PEAK_LANES_COUNT];
+} PeakKernels;
+
+#define PEAK_NO_SWAP(v) (v)
+
+#define DEFINE_PEAK_LANES(isa, attributes, vec, load, store, kind, swap, vmin, vmax) \
+attributes \
+static void \
+peak_ ## kind ## _ ## isa(const unsigned char *src, size_t num_vectors, unsigned char *min, unsigned char *max) \
+{ \
+    vec lo = swap(load(src)); \
+    vec hi = lo; \
+    for (size_t i=1; i<num_vectors; ++i) { \
+        vec v = swap(load(src + i * sizeof(vec))); \
+        lo = vmin(lo, v); \
+        hi = vmax(hi, v); \
+    } \
+    store(min, lo); \
+    store(max, hi); \
+}
+
+#if defined(PCM_CONVERT_X86_SIMD)
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_AVX512 __attribute__((target("avx512f,avx512bw")))
+
+#define LOADU_SSE2(p) _mm_loadu_si128((const __m128i *)(p))
+#define STOREU_SSE2(p, v) _mm_storeu_si128((__m128i *)(p), (v))
+#define LOADU_SSE2_PS(p) _mm_loadu_ps((const float *)(p))
+#define STOREU_SSE2_PS(p, v) _mm_storeu_ps((float *)(p), (v))
+#define SWAP16_SSE2(v) _mm_or_si128(_mm_slli_epi16((v), 8), _mm_srli_epi16((v), 8))
+
+/* SSE2 has no 32-bit integer minimum/maximum (added in SSE4.1) */
+TARGET_SSE2
+static inline __m128i
+min_epi32_sse2(__m128i a, __m128i b)
+{
+    __m128i greater = _mm_cmpgt_epi32(a, b);
+    return _mm_or_si128(_mm_and_si128(greater, b), _mm_andnot_si128(greater, a));
+}
+
+TARGET_SSE2
+static inline __m128i
+max_epi32_sse2(__m128i a, __m128i b)
+{
+    __m128i greater = _mm_cmpgt_epi32(a, b);
+    return _mm_or_si128(_mm_and_si128(greater, a), _mm_andnot_si128(greater, b));
+}
+
+DEFINE_PEAK_LANES(sse2, TARGET_SSE2, __m128i, LOADU_SSE2, STOREU_SSE2, u8, PEAK_NO_SWAP, _mm_min_epu8, _mm_max_epu8)
+DEFINE_PEAK_LANES(sse2, TARGET_SSE2, __m128i, LOADU_SSE2, STOREU_SSE2, s16, PEAK_NO_SWAP, _mm_min_epi16, _mm_max_epi16)
+DEFINE_PEAK_LANES(sse2, TARGET_SSE2, __m128i, LOADU_SSE2, STOREU_SSE2, s16_swap, SWAP16_SSE2, _mm_min_epi16, _mm_max_epi16)
+DEFINE_PEAK_LANES(sse2, TARGET_SSE2, __m128i, LOADU_SSE2, STOREU_SSE2, s32, PEAK_NO_SWAP, min_epi32_sse2, max_epi32_sse2)
+DEFINE_PEAK_LANES(sse2, TARGET_SSE2, __m128, LOADU_SSE2_PS, STOREU_SSE2_PS, f32, PEAK_NO_SWAP, _mm_min_ps, _mm_max_ps)
+
+#define LOADU_AVX2(p) _mm256_loadu_si256((const __m256i *)(p))
+#define STOREU_AVX2(p, v) _mm256_storeu_si256((__m256i *)(p), (v))
+#define LOADU_AVX2_PS(p) _mm256_loadu_ps((const float *)(p))
+#define STOREU_AVX2_PS(p, v) _mm256_storeu_ps((float *)(p), (v))
+#define SWAP16_AVX2(v) _mm256_or_si256(_mm256_slli_epi16((v), 8), _mm256_srli_epi16((v), 8))
+
+DEFINE_PEAK_LANES(avx2, TARGET_AVX2, __m256i, LOADU_AVX2, STOREU_AVX2, u8, PEAK_NO_SWAP, _mm256_min_epu8, _mm256_max_epu8)
+DEFINE_PEAK_LANES(avx2, TARGET_AVX2, __m256i, LOADU_AVX2, STOREU_AVX2, s16, PEAK_NO_SWAP, _mm256_min_epi16, _mm256_max_epi16)
+DEFINE_PEAK_LANES(avx2, TARGET_AVX2, __m256i, LOADU_AVX2, STOREU_AVX2, s16_swap, SWAP16_AVX2, _mm256_min_epi16, _mm256_max_epi16)
+DEFINE_PEAK_LANES(avx2, TARGET_AVX2, __m256i, LOADU_AVX2, STOREU_AVX2, s32, PEAK_NO_SWAP, _mm256_min_epi32, _mm256_max_epi32)
+DEFINE_PEAK_LANES(avx2, TARGET_AVX2, __m256, LOADU_AVX2_PS, STOREU_AVX2_PS, f32, PEAK_NO_SWAP, _mm256_min_ps, _mm256_max_ps)
+
+#define LOADU_AVX512(p) _mm512_loadu_si512((const void *)(p))
+#define STOREU_AVX512(p, v) _mm512_storeu_si512((void *)(p), (v))
+#define LOADU_AVX512_PS(p) _mm512_loadu_ps((const void *)(p))
+#define STOREU_AVX512_PS(p, v) _mm512_storeu_ps((void *)(p), (v))
+#define SWAP16_AVX512(v) _mm512_or_si512(_mm512_slli_epi16((v), 8), _mm512_srli_epi16((v), 8))
+
+DEFINE_PEAK_LANES(avx512, TARGET_AVX512, __m512i, LOADU_AVX512, STOREU_AVX512, u8, PEAK_NO_SWAP, _mm512_min_epu8, _mm512_max_epu8)
+DEFINE_PEAK_LANES(avx512, TARGET_AVX512, __m512i, LOADU_AVX512, STOREU_AVX512, s16, PEAK_NO_SWAP, _mm512_min_epi16, _mm512_max_epi16)
+DEFINE_PEAK_LANES(avx512, TARGET_AVX512, __m512i, LOADU_AVX512, STOREU_AVX512, s16_swap, SWAP16_AVX512, _mm512_min_epi16, _mm512_max_epi16)
+DEFINE_PEAK_LANES(avx512, TARGET_AVX512, __m512i, LOADU_AVX512, STOREU_AVX512, s32, PEAK_NO_SWAP, _mm512_min_epi32, _mm512_max_epi32)
+DEFINE_PEAK_LANES(avx512, TARGET_AVX512, __m512, LOADU_AVX512_PS, STOREU_AVX512_PS, f32, PEAK_NO_SWAP, _mm512_min_ps, _mm512_max_ps)
+
+#define PEAK_KERNELS(isa, vec) \
+    { sizeof(vec), { peak_u8_ ## isa, peak_s16_ ## isa, peak_s16_swap_ ## isa, peak_s32_ ## isa, peak_f32_ ## isa } }
+
+static const PeakKernels
+PEAK_KERNELS_SSE2 = PEAK_KERNELS(sse2, __m128i);
+
+static const PeakKernels
+PEAK_KERNELS_AVX2 = PEAK_KERNELS(avx2, __m256i);
+
+static const PeakKernels
+PEAK_KERNELS_AVX512 = PEAK_KERNELS(avx512, __m512i);
+#endif /* PCM_CONVERT_X86_SIMD */
+
+#if defined(PCM_CONVERT_NEON)
+#define LOADU_NEON_U8(p) vld1q_u8((const uint8_t *)(p))
+#define STOREU_NEON_U8(p, v) vst1q_u8((uint8_t *)(p), (v))
+#define LOADU_NEON_S16(p) vld1q_s16((const int16_t *)(p))
+#define LOADU_NEON_S16_SWAP(p) vreinterpretq_s16_u8(vrev16q_u8(vld1q_u8((const uint8_t *)(p))))
+#define STOREU_NEON_S16(p, v) vst1q_s16((int16_t *)(p), (v))
+#define LOADU_NEON_S32(p) vld1q_s32((const int32_t *)(p))
+#define STOREU_NEON_S32(p, v) vst1q_s32((int32_t *)(p), (v))
+#define LOADU_NEON_F32(p) vld1q_f32((const float *)(p))
+#define STOREU_NEON_F32(p, v) vst1q_f32((float *)(p), (v))
+
+DEFINE_PEAK_LANES(neon, /* baseline */, uint8x16_t, LOADU_NEON_U8, STOREU_NEON_U8, u8, PEAK_NO_SWAP, vminq_u8, vmaxq_u8)
+DEFINE_PEAK_LANES(neon, /* baseline */, int16x8_t, LOADU_NEON_S16, STOREU_NEON_S16, s16, PEAK_NO_SWAP, vminq_s16, vmaxq_s16)
+DEFINE_PEAK_LANES(neon, /* baseline */, int16x8_t, LOADU_NEON_S16_SWAP, STOREU_NEON_S16, s16_swap, PEAK_NO_SWAP, vminq_s16, vmaxq_s16)
+DEFINE_PEAK_LANES(neon, /* baseline */, int32x4_t, LOADU_NEON_S32, STOREU_NEON_S32, s32, PEAK_NO_SWAP, vminq_s32, vmaxq_s32)
+DEFINE_PEAK_LANES(neon, /* baseline */, float32x4_t, LOADU_NEON_F32, STOREU_NEON_F32, f32, PEAK_NO_SWAP, vminq_f32, vmaxq_f32)
+
+static const PeakKernels
+PEAK_KERNELS_NEON = {
+    16, { peak_u8_neon, peak_s16_neon, peak_s16_swap_neon, peak_s32_neon, peak_f32_neon },
+};
+#endif /* PCM_CONVERT_NEON */
+
+static const PeakKernels
+PEAK_KERNELS_NONE = { 0, { NULL } };
+
+static const PeakKernels *
+peak_kernels_select(void)
+{
+#if defined(PCM_CONVERT_X86_SIMD)
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+        return &PEAK_KERNELS_AVX512;
+    } else if (__builtin_cpu_supports("avx2")) {
+        return &PEAK_KERNELS_AVX2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        return &PEAK_KERNELS_SSE2;
+    }
+#elif defined(PCM_CONVERT_NEON)
+    return &PEAK_KERNELS_NEON;
+#endif
+
+    return &PEAK_KERNELS_NONE;
+}
+
+static const PeakKernels *
+peak_kernels_get(void)
+{
+    static gsize kernels = 0;
+
+    if (g_once_init_enter(&kernels)) {
+        g_once_init_leave(&kernels, (gsize)peak_kernels_select());
+    }
+
+    return (const PeakKernels *)kernels;
+}
+
+/**
+ * Runs the vector kernel over as many whole vectors of src as possible and
+ * combines the lanes of the first channel into *min and *max. Returns the
+ * number of bytes processed, which is a multiple of frame_size.
+ **/
+static size_t
+peak_vectors(enum PeakLanes lanes, const unsigned char *src, size_t num_bytes, size_t frame_size,
+        int32_t *min, int32_t *max)
+{
+    const PeakKernels *kernels = peak_kernels_get();
+    size_t width = kernels->width;
+
+    if (lanes == PEAK_LANES_NONE || width == 0 || width % frame_size != 0 || num_bytes < width) {
+        return 0;
+    }
+
+    unsigned char lo[PEAK_MAX_WIDTH];
+    unsigned char hi[PEAK_MAX_WIDTH];
+    size_t num_vectors = num_bytes / width;
+
+    kernels->lanes[lanes](src, num_vectors, lo, hi);
+
+    for (size_t i=0; i<width; i+=frame_size) {
+        int32_t lane_min, lane_max;
+
+        /* lanes hold little-endian samples (16-bit samples were swapped by the kernel) */
+        switch (lanes) {
+            case PEAK_LANES_U8:
+                lane_min = load_u8(lo + i);
+                lane_max = load_u8(hi + i);
+                break;
+            case PEAK_LANES_S16:
+            case PEAK_LANES_S16_SWAP:
+                lane_min = load_s16le(lo + i);
+                lane_max = load_s16le(hi + i);
+                break;
+            case PEAK_LANES_S32:
+                lane_min = load_s32le(lo + i);
+                lane_max = load_s32le(hi + i);
+                break;
+            default:
+                lane_min = load_f32le(lo + i);
+                lane_max = load_f32le(hi + i);
+                break;
+        }
+
+        *min = MIN(*min, lane_min);
+        *max = MAX(*max, lane_max);
+    }
+
+    return num_vectors * width;
+}
+
+#define DEFINE_PEAK_KERNELS(layout, bytes, load_s32, lanes) \
+static void \
+layout ## _peak_s32_multi(const unsigned char *src, size_t num_frames, unsigned int channels, int32_t *min, int32_t *max) \
+{ \
+    int32_t lo = INT32_MAX; \
+    int32_t hi = INT32_MIN; \
+    for (size_t i=0; i<num_frames; ++i) { \
+        int32_t value = load_s32(src + i * channels * (bytes)); \
+        lo = MIN(lo, value); \
+        hi = MAX(hi, value); \
+    } \
+    *min = lo; \
+    *max = hi; \
+} \
+\
+static void \
+layout ## _peak_s32_mono(const unsigned char *src, size_t num_frames, unsigned int channels, int32_t *min, int32_t *max) \
+{ \
+    *min = INT32_MAX; \
+    *max = INT32_MIN; \
+    size_t done = peak_vectors(lanes, src, num_frames * (bytes), (bytes), min, max); \
+    int32_t tail_min, tail_max; \
+    layout ## _peak_s32_multi(src + done, num_frames - done / (bytes), 1, &tail_min, &tail_max); \
+    *min = MIN(*min, tail_min); \
+    *max = MAX(*max, tail_max); \
+} \
+\
+static void \
+layout ## _peak_s32_stereo(const unsigned char *src, size_t num_frames, unsigned int channels, int32_t *min, int32_t *max) \
+{ \
+    *min = INT32_MAX; \
+    *max = INT32_MIN; \
+    size_t done = peak_vectors(lanes, src, num_frames * 2 * (bytes), 2 * (bytes), min, max); \
+    int32_t tail_min, tail_max; \
+    layout ## _peak_s32_multi(src + done, num_frames - done / (2 * (bytes)), 2, &tail_min, &tail_max); \
+    *min = MIN(*min, tail_min); \
+    *max = MAX(*max, tail_max); \
+}
+
+DEFINE_PEAK_KERNELS(u8, 1, load_u8, PEAK_LANES_U8)
+DEFINE_PEAK_KERNELS(s16le, 2, load_s16le, PEAK_LANES_S16)
+DEFINE_PEAK_KERNELS(s16be, 2, load_s16be, PEAK_LANES_S16_SWAP)
+DEFINE_PEAK_KERNELS(s24le, 3, load_s24le, PEAK_LANES_NONE)
+DEFINE_PEAK_KERNELS(s32le, 4, load_s32le, PEAK_LANES_S32)
+DEFINE_PEAK_KERNELS(f32le, 4, load_f32le, PEAK_LANES_F32)
+
+#define CONVERTERS(layout, bytes) \
+    { \
+        { #layout " (mono)", bytes, layout ## _to_f32_mono, layout ## _to_s32_mono, layout ## _peak_s32_mono }, \
+        { #layout " (stereo)", bytes, layout ## _to_f32_stereo, layout ## _to_s32_stereo, layout ## _peak_s32_stereo }, \
+        { #layout, bytes, layout ## _to_f32_multi, layout ## _to_s32_multi, layout ## _peak_s32_multi }, \
+    }
+
+enum PcmLayout {
+    PCM_LAYOUT_U8 = 0,
+    PCM_LAYOUT_S16LE,
+    PCM_LAYOUT_S24LE,
+    PCM_LAYOUT_S32LE,
+    PCM_LAYOUT_F32LE,
+    PCM_LAYOUT_S16BE,
+};
+
+static const PcmConverter
+PCM_CONVERTERS[][3] = {
+    [PCM_LAYOUT_U8] = CONVERTERS(u8, 1),
+    [PCM_LAYOUT_S16LE] = CONVERTERS(s16le, 2),
+    [PCM_LAYOUT_S24LE] = CONVERTERS(s24le, 3),
+    [PCM_LAYOUT_S32LE] = CONVERTERS(s32le, 4),
+    [PCM_LAYOUT_F32LE] = CONVERTERS(f32le, 4),
+    [PCM_LAYOUT_S16BE] = CONVERTERS(s16be, 2),
+};
+
+static const PcmConverter *
+pcm_converter_get_for_layout(const SampleInfo *sample_info, enum PcmLayout layout)
+{
+    if (sample_info->channels == 0 ||
+            sample_info->blockAlign != sample_info->channels * PCM_CONVERTERS[layout][0].bytes_per_sample) {
+        return NULL;
+    }
+
+    switch (sample_info->channels) {
+        case 1: return &PCM_CONVERTERS[layout][0];
+        case 2: return &PCM_CONVERTERS[layout][1];
+        default: return &PCM_CONVERTERS[layout][2];
+    }
+}
+
+const PcmConverter *
+pcm_converter_get(const SampleInfo *sample_info)
+{
+    enum PcmLayout layout;
+
+    if (sample_info->isFloat) {
+        if (sample_info->bitsPerSample != 32) {
+            return NULL;
+        }
+
+        layout = PCM_LAYOUT_F32LE;
+    } else {
+        switch (sample_info->bitsPerSample) {
+            case 8: layout = PCM_LAYOUT_U8; break;
+            case 16: layout = PCM_LAYOUT_S16LE; break;
+            case 24: layout = PCM_LAYOUT_S24LE; break;
+            case 32: layout = PCM_LAYOUT_S32LE; break;
+            default: return NULL;
+        }
+    }
+
+    return pcm_converter_get_for_layout(sample_info, layout);
+}
+
+const PcmConverter *
+pcm_converter_get_big_endian(const SampleInfo *sample_info)
+{
+    if (sample_info->isFloat || sample_info->bitsPerSample != 16) {
+        return NULL;
+    }
+
+    return pcm_converter_get_for_layout(sample_info, PCM_LAYOUT_S16BE);
+}
+
+void
+pcm_convert_f32le_to_s16le(const unsigned char *src, unsigned char *dst, size_t num_samples)
+{
+    for (size_t i = 0; i < num_samples; ++i) {
+        uint32_t value = (uint32_t)load_f32le(src + 4 * i) >> 16;
+
+        dst[2 * i + 0] = value & 0xFF;
+        dst[2 * i + 1] = (value >> 8) & 0xFF;
+    }
+}
+
+/**
+ * Byte swapping of 16-bit samples, with vector kernels selected at runtime
+ * on x86 (the compiler is told to generate SSSE3/AVX2 code only for these
+ * functions, so the rest of the program still runs on any x86 CPU) and
+ * NEON on ARM, where it is part of the baseline if __ARM_NEON is defined.
+ **/
+
+static void
+swap16_scalar(const unsigned char *src, unsigned char *dst, size_t num_bytes)
+{
+    for (size_t i = 0; i + 1 < num_bytes; i += 2) {
+        unsigned char tmp = src[i];
+        dst[i] = src[i + 1];
+        dst[i + 1] = tmp;
+    }
+}
+
+#if defined(PCM_CONVERT_X86_SIMD)
+__attribute__((target("ssse3")))
+static void
+swap16_ssse3(const unsigned char *src, unsigned char *dst, size_t num_bytes)
+{
+    const __m128i shuffle = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    size_t i = 0;
+
+    for (; i + 16 <= num_bytes; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_shuffle_epi8(v, shuffle));
+    }
+
+    swap16_scalar(src + i, dst + i, num_bytes - i);
+}
+
+__attribute__((target("avx2")))
+static void
+swap16_avx2(const unsigned char *src, unsigned char *dst, size_t num_bytes)
+{
+    const __m256i shuffle = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+                                             1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    size_t i = 0;
+
+    for (; i + 32 <= num_bytes; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_shuffle_epi8(v, shuffle));
+    }
+
+    swap16_scalar(src + i, dst + i, num_bytes - i);
+}
+#endif /* PCM_CONVERT_X86_SIMD */
+
+#if defined(PCM_CONVERT_NEON)
+static void
+swap16_neon(const unsigned char *src, unsigned char *dst, size_t num_bytes)
+{
+    size_t i = 0;
+
+    for (; i + 16 <= num_bytes; i += 16) {
+        vst1q_u8(dst + i, vrev16q_u8(vld1q_u8(src + i)));
+    }
+
+    swap16_scalar(src + i, dst + i, num_bytes - i);
+}
+#endif /* PCM_CONVERT_NEON */
+
+typedef void (*swap16_func)(const unsigned char *src, unsigned char *dst, size_t num_bytes);
+
+static swap16_func
+swap16_select(void)
+{
+#if defined(PCM_CONVERT_X86_SIMD)
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2")) {
+        return swap16_avx2;
+    } else if (__builtin_cpu_supports("ssse3")) {
+        return swap16_ssse3;
+    }
+#elif defined(PCM_CONVERT_NEON)
+    return swap16_neon;
+#endif
+
+    return swap16_scalar;
+}
+
+void
+pcm_convert_swap16(const unsigned char *src, unsigned char *dst, size_t num_bytes)
+{
+    static gsize impl = 0;
+
+    if (g_once_init_enter(&impl)) {
+        g_once_init_leave(&impl, (gsize)swap16_select());
+    }
+
+    ((swap16_func)impl)(src, dst, num_bytes);
+}
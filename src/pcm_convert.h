@@ -0,0 +1,75 @@
+/* wavbreaker - A tool to split a wave file up into multiple waves.
+ * Copyright (C) 2022 Thomas Perl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#pragma once
+
+#include "sample_info.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Conversion of interleaved little-endian sample data (as returned by
+ * format_read_samples()) into planar buffers, one per channel:
+ *
+ *  - to_f32: normalized to [-1.0, 1.0) (float samples are passed through
+ *            as they are, so they can exceed that range)
+ *  - to_s32: normalized to the full int32_t range (MSB-aligned, so that
+ *            shifting right by (32 - bits) gives the original sample value;
+ *            float samples are clipped)
+ *
+ * Converters are specialized per sample layout and channel count, and
+ * are looked up once per file with pcm_converter_get(). Peak detection
+ * uses SIMD instructions (selected at runtime) where the CPU supports them.
+ **/
+
+typedef struct PcmConverter_ PcmConverter;
+
+struct PcmConverter_ {
+    const char *name;
+    unsigned short bytes_per_sample;
+
+    void (*to_f32)(const unsigned char *src, float *const dst[], size_t num_frames, unsigned int channels);
+    void (*to_s32)(const unsigned char *src, int32_t *const dst[], size_t num_frames, unsigned int channels);
+
+    /* minimum and maximum of the first channel, in the range of to_s32() (*min > *max if num_frames == 0) */
+    void (*peak_s32)(const unsigned char *src, size_t num_frames, unsigned int channels, int32_t *min, int32_t *max);
+};
+
+const PcmConverter *
+pcm_converter_get(const SampleInfo *sample_info);
+
+/* Converter for big-endian samples with the given layout (only 16-bit integer samples) */
+const PcmConverter *
+pcm_converter_get_big_endian(const SampleInfo *sample_info);
+
+/**
+ * Convert interleaved little-endian 32-bit float samples to 16-bit signed
+ * integers, e.g. for output devices without float support. The conversion
+ * can be done in place (dst == src).
+ **/
+void
+pcm_convert_f32le_to_s16le(const unsigned char *src, unsigned char *dst, size_t num_samples);
+
+/**
+ * Swap the bytes of 16-bit samples (big-endian <-> little-endian), using
+ * SIMD instructions if the CPU supports them. The conversion can be done
+ * in place (dst == src).
+ **/
+void
+pcm_convert_swap16(const unsigned char *src, unsigned char *dst, size_t num_bytes);
@@ -34,6 +34,8 @@
 #include "track_break.h"
 
 #include "format.h"
+#include "io_engine.h"
+#include "seek_cache.h"
 #include "gettext.h"
 
 typedef struct WriteThreadData_ WriteThreadData;
@@ -53,9 +55,21 @@ struct Sample_ {
     gchar *basename_without_extension;
 
     GMutex load_mutex;
+    GCond info_cond;
+    gboolean info_estimated;
     gboolean loaded;
     GraphData graph_data;
-    double load_percentage;
+
+    /* analysis progress, blocks_analyzed is updated atomically by the workers */
+    long int blocks_total;
+    gint blocks_analyzed;
+
+    /* graph_data is final for the blocks [0, blocks_published) */
+    unsigned long blocks_published;
+
+    /* set by sample_close() to stop the analysis early */
+    GThread *open_thread;
+    gint cancel_analysis;
 
     GThread *play_thread;
     GMutex play_mutex;
@@ -74,15 +88,8 @@ struct Sample_ {
 static void
 sample_max_min(Sample *sample);
 
-static long
-read_sample(OpenedAudioFile *oaf, unsigned char *buf, int buf_size, unsigned long start_pos)
-{
-    if (oaf != NULL) {
-        return format_read_samples(oaf, buf, buf_size, start_pos);
-    }
-
-    return -1;
-}
+static void
+graph_data_clear(GraphData *graph_data);
 
 void sample_init()
 {
@@ -97,7 +104,8 @@ play_thread(gpointer thread_data)
     int read_ret = 0;
     int i;
 
-    unsigned char *devbuf;
+    FormatReader *reader;
+    const unsigned char *samples;
 
     /*
     printf("play_thread: calling open_audio_device\n");
@@ -114,26 +122,13 @@ play_thread(gpointer thread_data)
 
     i = 0;
 
-    devbuf = malloc(DEFAULT_BUF_SIZE);
-    if (devbuf == NULL) {
-        g_mutex_lock(&sample->play_mutex);
-        sample->playing = FALSE;
-        ao_audio_close_device();
-        g_mutex_unlock(&sample->play_mutex);
-        printf("play_thread: out of memory\n");
-        return NULL;
-    }
+    reader = format_reader_open(sample->opened_audio_file, sample->play_start_position);
 
-    read_ret = read_sample(sample->opened_audio_file, devbuf, DEFAULT_BUF_SIZE, sample->play_start_position + (DEFAULT_BUF_SIZE * i++));
+    read_ret = format_reader_next(reader, &samples, DEFAULT_BUF_SIZE);
+    i++;
 
     while (read_ret > 0 && read_ret <= DEFAULT_BUF_SIZE) {
-        /*
-        if (read_ret < 0) {
-            printf("read_ret: %d\n", read_ret);
-        }
-        */
-
-        ao_audio_write(devbuf, read_ret);
+        ao_audio_write(samples, read_ret);
 
         if (g_mutex_trylock(&sample->play_mutex)) {
             if (sample->kill_play_thread) {
@@ -141,12 +136,14 @@ play_thread(gpointer thread_data)
                 sample->playing = FALSE;
                 sample->kill_play_thread = FALSE;
                 g_mutex_unlock(&sample->play_mutex);
+                format_reader_close(reader);
                 return NULL;
             }
             g_mutex_unlock(&sample->play_mutex);
         }
 
-        read_ret = read_sample(sample->opened_audio_file, devbuf, DEFAULT_BUF_SIZE, sample->play_start_position + (DEFAULT_BUF_SIZE * i++));
+        read_ret = format_reader_next(reader, &samples, DEFAULT_BUF_SIZE);
+        i++;
 
         g_mutex_lock(&sample->play_mutex);
 
@@ -155,6 +152,8 @@ play_thread(gpointer thread_data)
         g_mutex_unlock(&sample->play_mutex);
     }
 
+    format_reader_close(reader);
+
     g_mutex_lock(&sample->play_mutex);
 
     ao_audio_close_device();
@@ -245,12 +244,32 @@ sample_stop(Sample *sample)
     g_thread_join(g_steal_pointer(&sample->play_thread));
 }
 
+static void
+sample_info_changed(OpenedAudioFile *file, void *user_data)
+{
+    Sample *sample = user_data;
+
+    g_mutex_lock(&sample->load_mutex);
+    sample->info_estimated = FALSE;
+    g_cond_broadcast(&sample->info_cond);
+    g_mutex_unlock(&sample->load_mutex);
+}
+
 static gpointer
 open_thread(gpointer data)
 {
     Sample *sample = data;
 
-    sample_max_min(sample);
+    /* the graph is laid out for the exact length, which might still be determined in the background */
+    g_mutex_lock(&sample->load_mutex);
+    while (sample->info_estimated && !g_atomic_int_get(&sample->cancel_analysis)) {
+        g_cond_wait(&sample->info_cond, &sample->load_mutex);
+    }
+    g_mutex_unlock(&sample->load_mutex);
+
+    if (!g_atomic_int_get(&sample->cancel_analysis)) {
+        sample_max_min(sample);
+    }
 
     return NULL;
 }
@@ -282,11 +301,17 @@ sample_open(const char *filename, char **error_message)
     sample->basename_without_extension = tmp;
 
     g_mutex_init(&sample->load_mutex);
+    g_cond_init(&sample->info_cond);
     g_mutex_init(&sample->play_mutex);
     g_mutex_init(&sample->write_mutex);
 
-    // TODO: Capture thread and properly tear it down - if needed - in sample_close()
-    g_thread_unref(g_thread_new("open file", open_thread, sample));
+    /* sample_info_changed() might be called before this returns */
+    sample->info_estimated = TRUE;
+    if (!format_set_info_changed_callback(sample->opened_audio_file, sample_info_changed, sample)) {
+        sample->info_estimated = FALSE;
+    }
+
+    sample->open_thread = g_thread_new("open file", open_thread, sample);
 
     return sample;
 }
@@ -303,7 +328,7 @@ sample_get_graph_data(Sample *sample)
     GraphData *result = NULL;
 
     g_mutex_lock(&sample->load_mutex);
-    if (sample->loaded) {
+    if (sample->graph_data.data != NULL) {
         result = &sample->graph_data;
     }
     g_mutex_unlock(&sample->load_mutex);
@@ -311,6 +336,18 @@ sample_get_graph_data(Sample *sample)
     return result;
 }
 
+unsigned long
+sample_get_analyzed_blocks(Sample *sample)
+{
+    unsigned long result;
+
+    g_mutex_lock(&sample->load_mutex);
+    result = sample->blocks_published;
+    g_mutex_unlock(&sample->load_mutex);
+
+    return result;
+}
+
 unsigned long
 sample_get_num_sample_blocks(Sample *sample)
 {
@@ -324,10 +361,20 @@ sample_close(Sample *sample)
     g_free(sample->filename_basename);
     g_free(sample->filename_dirname);
 
+    /* the graph data can be used before it is complete, so the analysis might still be running */
+    g_mutex_lock(&sample->load_mutex);
+    g_atomic_int_set(&sample->cancel_analysis, TRUE);
+    g_cond_broadcast(&sample->info_cond);
+    g_mutex_unlock(&sample->load_mutex);
+
+    g_thread_join(sample->open_thread);
+
     if (sample->opened_audio_file != NULL) {
         format_close_file(g_steal_pointer(&sample->opened_audio_file));
     }
 
+    graph_data_clear(&sample->graph_data);
+
     g_free(sample);
 }
 
@@ -349,7 +396,13 @@ sample_get_load_percentage(Sample *sample)
     double result;
 
     g_mutex_lock(&sample->load_mutex);
-    result = sample->load_percentage;
+    if (sample->loaded) {
+        result = 1.0;
+    } else if (sample->blocks_total > 0) {
+        result = (double) g_atomic_int_get(&sample->blocks_analyzed) / sample->blocks_total;
+    } else {
+        result = 0.0;
+    }
     g_mutex_unlock(&sample->load_mutex);
 
     return result;
@@ -385,21 +438,397 @@ sample_get_basename_without_extension(Sample *sample)
     return sample->basename_without_extension;
 }
 
+static inline void
+points_merge(Points *a, const Points *b)
+{
+    a->min = MIN(a->min, b->min);
+    a->max = MAX(a->max, b->max);
+}
+
+unsigned long
+graph_data_get_level_size(GraphData *graph_data, int level)
+{
+    /* rounded up, the last point of a level may cover fewer blocks */
+    return (graph_data->numSamples + (1UL << level) - 1) >> level;
+}
+
+static void
+graph_data_set_size(GraphData *graph_data, unsigned long numSamples)
+{
+    graph_data->numSamples = numSamples;
+    graph_data->numLevels = 1;
+    while (graph_data_get_level_size(graph_data, graph_data->numLevels - 1) > 1) {
+        graph_data->numLevels++;
+    }
+}
+
+static gboolean
+graph_data_alloc(GraphData *graph_data, unsigned long numSamples)
+{
+    int level;
+
+    graph_data_set_size(graph_data, numSamples);
+
+    /* blocks after the end of the samples are left empty */
+    for (level = 0; level < graph_data->numLevels; level++) {
+        graph_data->levels[level] = calloc(graph_data_get_level_size(graph_data, level), sizeof(Points));
+        if (graph_data->levels[level] == NULL) {
+            return FALSE;
+        }
+    }
+
+    graph_data->data = graph_data->levels[0];
+
+    return TRUE;
+}
+
+static void
+graph_data_clear(GraphData *graph_data)
+{
+    int level;
+
+    for (level = 0; level < graph_data->numLevels; level++) {
+        if (graph_data->cache_mapping == NULL) {
+            free(graph_data->levels[level]);
+        }
+        graph_data->levels[level] = NULL;
+    }
+
+    if (graph_data->cache_mapping != NULL) {
+        g_clear_pointer(&graph_data->cache_mapping, g_mapped_file_unref);
+    }
+
+    graph_data->numLevels = 0;
+    graph_data->data = NULL;
+}
+
+/* Kind of seek cache entry that stores the GraphData of a file */
+#define PEAK_CACHE_KIND "peaks"
+#define PEAK_CACHE_VERSION 1
+
+/* followed by the levels of the pyramid, from the finest to the coarsest */
+typedef struct PeakCacheHeader_ PeakCacheHeader;
+struct PeakCacheHeader_ {
+    uint32_t version;
+    uint32_t num_levels;
+    uint64_t num_samples;
+    uint64_t max_sample_value;
+    uint64_t max_sample_amp;
+    uint64_t min_sample_amp;
+};
+
+/* Maps the peaks of a previous analysis of the file, if it has not changed since */
+static gboolean
+graph_data_load_cache(GraphData *graph_data, OpenedAudioFile *file, unsigned long numSamples)
+{
+    PeakCacheHeader header;
+    const void *data;
+    size_t size, offset;
+    int level;
+
+    GMappedFile *mapping = seek_cache_map(file, PEAK_CACHE_KIND, &data, &size);
+    if (mapping == NULL) {
+        return FALSE;
+    }
+
+    if (size < sizeof(header)) {
+        goto error;
+    }
+
+    memcpy(&header, data, sizeof(header));
+    graph_data_set_size(graph_data, numSamples);
+
+    if (header.version != PEAK_CACHE_VERSION || header.num_samples != numSamples ||
+            header.num_levels != graph_data->numLevels) {
+        goto error;
+    }
+
+    offset = sizeof(header);
+    for (level = 0; level < graph_data->numLevels; level++) {
+        size_t level_size = graph_data_get_level_size(graph_data, level) * sizeof(Points);
+        if (offset + level_size > size) {
+            goto error;
+        }
+
+        graph_data->levels[level] = (Points *)((const char *)data + offset);
+        offset += level_size;
+    }
+
+    if (offset != size) {
+        goto error;
+    }
+
+    graph_data->data = graph_data->levels[0];
+    graph_data->maxSampleValue = header.max_sample_value;
+    graph_data->maxSampleAmp = header.max_sample_amp;
+    graph_data->minSampleAmp = header.min_sample_amp;
+    graph_data->cache_mapping = mapping;
+
+    return TRUE;
+
+error:
+    g_debug("Ignoring invalid peak cache for %s", file->filename);
+    g_mapped_file_unref(mapping);
+    memset(graph_data, 0, sizeof(*graph_data));
+
+    return FALSE;
+}
+
+static void
+graph_data_save_cache(GraphData *graph_data, OpenedAudioFile *file)
+{
+    PeakCacheHeader header = {
+        .version = PEAK_CACHE_VERSION,
+        .num_levels = graph_data->numLevels,
+        .num_samples = graph_data->numSamples,
+        .max_sample_value = graph_data->maxSampleValue,
+        .max_sample_amp = graph_data->maxSampleAmp,
+        .min_sample_amp = graph_data->minSampleAmp,
+    };
+    size_t size = sizeof(header);
+    int level;
+
+    for (level = 0; level < graph_data->numLevels; level++) {
+        size += graph_data_get_level_size(graph_data, level) * sizeof(Points);
+    }
+
+    char *buf = g_malloc(size);
+    char *dst = buf;
+
+    memcpy(dst, &header, sizeof(header));
+    dst += sizeof(header);
+
+    for (level = 0; level < graph_data->numLevels; level++) {
+        size_t level_size = graph_data_get_level_size(graph_data, level) * sizeof(Points);
+        memcpy(dst, graph_data->levels[level], level_size);
+        dst += level_size;
+    }
+
+    seek_cache_save(file, PEAK_CACHE_KIND, buf, size);
+    g_free(buf);
+}
+
+/**
+ * Fill levels [first_level, last_level] of the pyramid after the blocks
+ * [start, end) have changed. All blocks before start must be final. Points
+ * that extend past end are skipped (unless end is the end of the file), so
+ * that points are never modified once they have been filled in.
+ **/
+static void
+graph_data_build_levels(GraphData *graph_data, int first_level, int last_level, unsigned long start, unsigned long end)
+{
+    int level;
+    unsigned long i;
+
+    for (level = 1; level <= last_level && level < graph_data->numLevels; level++) {
+        Points *src = graph_data->levels[level - 1];
+        Points *dst = graph_data->levels[level];
+        unsigned long src_size = graph_data_get_level_size(graph_data, level - 1);
+
+        start >>= 1;
+        end = (end == src_size) ? ((end + 1) >> 1) : (end >> 1);
+
+        if (level < first_level) {
+            continue;
+        }
+
+        for (i = start; i < end; i++) {
+            dst[i] = src[2 * i];
+            if (2 * i + 1 < src_size) {
+                points_merge(&dst[i], &src[2 * i + 1]);
+            }
+        }
+    }
+}
+
+Points
+graph_data_get_range(GraphData *graph_data, unsigned long start, unsigned long end)
+{
+    Points result = { 0, 0 };
+    int level = 0;
+
+    end = MIN(end, graph_data->numSamples);
+
+    /* merge the unpaired points at both ends, then go up one level */
+    while (start < end && level < graph_data->numLevels) {
+        if (start & 1) {
+            points_merge(&result, &graph_data->levels[level][start++]);
+        }
+        if (end & 1) {
+            points_merge(&result, &graph_data->levels[level][--end]);
+        }
+
+        start >>= 1;
+        end >>= 1;
+        level++;
+    }
+
+    return result;
+}
+
+/* Pyramid levels built by each work item, a chunk covers exactly one point of the last one */
+#define ANALYSIS_CHUNK_LEVELS 11
+
+/* Number of blocks per work item when analyzing (about 27 seconds of audio) */
+#define ANALYSIS_CHUNK_BLOCKS (1 << ANALYSIS_CHUNK_LEVELS)
+
+/* Number of blocks after which a chunk reports its progress (one second of audio) */
+#define ANALYSIS_PROGRESS_BLOCKS (CD_BLOCKS_PER_SEC)
+
+typedef struct AnalysisChunk_ AnalysisChunk;
+typedef struct Analysis_ Analysis;
+struct Analysis_ {
+    Sample *sample;
+    int analysis_bits;
+
+    AnalysisChunk *chunks;
+    long int num_chunks;
+
+    /* chunks before this one have been published, protected by sample->load_mutex */
+    long int next_chunk;
+};
+
+struct AnalysisChunk_ {
+    Analysis *analysis;
+
+    /* range of blocks to analyze */
+    long int first_block;
+    long int end_block;
+
+    /* protected by sample->load_mutex */
+    gboolean done;
+
+    /* result */
+    int min_sample, max_sample;
+};
+
+/**
+ * Publish the blocks of all finished chunks at the start of the file, so
+ * that the graph data can be used while the rest is still being analyzed.
+ * Must be called with sample->load_mutex held.
+ **/
+static void
+sample_publish_chunks(Analysis *analysis)
+{
+    Sample *sample = analysis->sample;
+    GraphData *graph_data = &sample->graph_data;
+    unsigned long start = sample->blocks_published;
+    unsigned long end;
+
+    while (analysis->next_chunk < analysis->num_chunks && analysis->chunks[analysis->next_chunk].done) {
+        analysis->next_chunk++;
+    }
+
+    if (analysis->next_chunk == analysis->num_chunks) {
+        end = graph_data->numSamples;
+    } else {
+        end = analysis->chunks[analysis->next_chunk].first_block;
+    }
+
+    if (end > start) {
+        /* coarse levels span several chunks, and are only filled in once all of them are done */
+        graph_data_build_levels(graph_data, ANALYSIS_CHUNK_LEVELS + 1, graph_data->numLevels - 1, start, end);
+        sample->blocks_published = end;
+    }
+}
+
+static void
+sample_max_min_chunk(gpointer data, gpointer user_data)
+{
+    AnalysisChunk *chunk = data;
+    Sample *sample = chunk->analysis->sample;
+    SampleInfo *sample_info = &sample->opened_audio_file->sample_info;
+    Points *graph_data = sample->graph_data.data;
+    int analysis_bits = chunk->analysis->analysis_bits;
+    long int ret = 0;
+    int min, max;
+    int32_t peak_min, peak_max;
+    int min_sample, max_sample;
+    long int i;
+    gint blocks_pending = 0;
+    size_t frames_per_block;
+    FormatReader *reader;
+
+    if (g_atomic_int_get(&sample->cancel_analysis)) {
+        return;
+    }
+
+    frames_per_block = sample_info->blockSize / sample_info->blockAlign;
+
+    i = chunk->first_block;
+
+    /* only the first channel is used for the graph */
+    reader = format_reader_open(sample->opened_audio_file, i * frames_per_block * sample_info->blockAlign);
+    ret = format_reader_next_peak_s32(reader, frames_per_block, &peak_min, &peak_max);
+
+    min_sample = SHRT_MAX; /* highest value for 16-bit samples */
+    max_sample = 0;
+
+    while (ret == (long int)frames_per_block && i < chunk->end_block) {
+        /* the range of each block always includes 0 */
+        min = MIN(0, peak_min >> (32 - analysis_bits));
+        max = MAX(0, peak_max >> (32 - analysis_bits));
+
+        graph_data[i].min = min;
+        graph_data[i].max = max;
+
+        if( min_sample > (max-min)) {
+            min_sample = (max-min);
+        }
+        if( max_sample < (max-min)) {
+            max_sample = (max-min);
+        }
+
+        i++;
+
+        if (i < chunk->end_block) {
+            ret = format_reader_next_peak_s32(reader, frames_per_block, &peak_min, &peak_max);
+        }
+
+        /* progress is shared by all chunks, so only publish it every now and then */
+        if (++blocks_pending == ANALYSIS_PROGRESS_BLOCKS) {
+            g_atomic_int_add(&sample->blocks_analyzed, blocks_pending);
+            blocks_pending = 0;
+
+            if (g_atomic_int_get(&sample->cancel_analysis)) {
+                break;
+            }
+        }
+    }
+
+    format_reader_close(reader);
+
+    /* an unfinished chunk is never published */
+    if (g_atomic_int_get(&sample->cancel_analysis)) {
+        return;
+    }
+
+    /* the finer levels of the pyramid only depend on the blocks of this chunk */
+    graph_data_build_levels(&sample->graph_data, 1, ANALYSIS_CHUNK_LEVELS, chunk->first_block, chunk->end_block);
+
+    g_atomic_int_add(&sample->blocks_analyzed, blocks_pending);
+
+    chunk->min_sample = min_sample;
+    chunk->max_sample = max_sample;
+
+    g_mutex_lock(&sample->load_mutex);
+    chunk->done = TRUE;
+    sample_publish_chunks(chunk->analysis);
+    g_mutex_unlock(&sample->load_mutex);
+}
+
 static void
 sample_max_min(Sample *sample)
 {
     GraphData *graphData = &sample->graph_data;
 
     SampleInfo *sample_info = &sample->opened_audio_file->sample_info;
-    int tmp = 0;
-    long int ret = 0;
-    int min, max, xtmp;
     int min_sample, max_sample;
-    long int i, k;
+    long int i;
     long int numSampleBlocks;
     long int tmp_sample_calc;
-    unsigned char devbuf[sample->opened_audio_file->sample_info.blockSize];
-    Points *graph_data;
+    int analysis_bits;
+    GraphData graph_data = { 0 };
 
     tmp_sample_calc = sample_info->numBytes;
     tmp_sample_calc = tmp_sample_calc / sample_info->blockSize;
@@ -415,87 +844,110 @@ sample_max_min(Sample *sample)
     */
     /* DEBUG CODE END */
 
-    graph_data = (Points *)malloc(numSampleBlocks * sizeof(Points));
+    /* the peaks of an earlier analysis can be used as long as the file is unchanged */
+    if (graph_data_load_cache(&graph_data, sample->opened_audio_file, numSampleBlocks)) {
+        g_mutex_lock(&sample->load_mutex);
+        graph_data_clear(graphData);
+        *graphData = graph_data;
+        sample->blocks_published = numSampleBlocks;
+        sample->loaded = TRUE;
+        g_mutex_unlock(&sample->load_mutex);
+        return;
+    }
 
-    if (graph_data == NULL) {
+    if (!graph_data_alloc(&graph_data, numSampleBlocks)) {
         printf("NULL returned from malloc of graph_data\n");
+        graph_data_clear(&graph_data);
         return;
     }
 
-    i = 0;
+    /* samples are decoded to MSB-aligned int32_t, the graph uses at most 24 bits */
+    if (sample_info->isFloat || sample_info->bitsPerSample > 24) {
+        analysis_bits = 24;
+    } else {
+        analysis_bits = sample_info->bitsPerSample;
+    }
 
-    ret = read_sample(sample->opened_audio_file, devbuf, sample_info->blockSize, sample_info->blockSize * i);
+    if (sample_info->bitsPerSample == 8) {
+        graph_data.maxSampleValue = UCHAR_MAX;
+    } else if (sample_info->bitsPerSample == 16) {
+        graph_data.maxSampleValue = SHRT_MAX;
+    } else if (analysis_bits == 24) {
+        graph_data.maxSampleValue = 0x7fffff;
+    }
 
-    min_sample = SHRT_MAX; /* highest value for 16-bit samples */
-    max_sample = 0;
+    /* from here on, blocks become visible to sample_get_graph_data() users as they are analyzed */
+    g_mutex_lock(&sample->load_mutex);
+    graph_data_clear(graphData);
+    *graphData = graph_data;
+    sample->blocks_published = 0;
+    sample->blocks_total = numSampleBlocks;
+    g_atomic_int_set(&sample->blocks_analyzed, 0);
+    g_mutex_unlock(&sample->load_mutex);
 
-    while (ret == sample_info->blockSize && i < numSampleBlocks) {
-        min = max = 0;
-        for (k = 0; k < ret; k++) {
-            if (sample_info->bitsPerSample == 8) {
-                tmp = devbuf[k];
-                tmp -= 128;
-            } else if (sample_info->bitsPerSample == 16) {
-                tmp = (char)devbuf[k+1] << 8 | (char)devbuf[k];
-                k++;
-	    } else if (sample_info->bitsPerSample == 24) {
-		tmp   = ((char)devbuf[k]) | ((char)devbuf[k+1] << 8);
-		tmp  &= 0x0000ffff;
-		xtmp  =  (char)devbuf[k+2] << 16;
-		tmp  |= xtmp;
-		k += 2;
-            }
+    Analysis analysis = {
+        .sample = sample,
+        .analysis_bits = analysis_bits,
+        .num_chunks = (numSampleBlocks + ANALYSIS_CHUNK_BLOCKS - 1) / ANALYSIS_CHUNK_BLOCKS,
+    };
 
-            if (tmp > max) {
-                max = tmp;
-            } else if (tmp < min) {
-                min = tmp;
-            }
+    analysis.chunks = g_new0(AnalysisChunk, analysis.num_chunks);
 
-            // skip over any extra channels
-            k += (sample_info->channels - 1) * (sample_info->bitsPerSample / 8);
-        }
+    for (i = 0; i < analysis.num_chunks; i++) {
+        AnalysisChunk *chunk = &analysis.chunks[i];
 
-        graph_data[i].min = min;
-        graph_data[i].max = max;
+        chunk->analysis = &analysis;
+        chunk->first_block = i * ANALYSIS_CHUNK_BLOCKS;
+        chunk->end_block = MIN(numSampleBlocks, (i + 1) * ANALYSIS_CHUNK_BLOCKS);
+    }
 
-        if( min_sample > (max-min)) {
-            min_sample = (max-min);
-        }
-        if( max_sample < (max-min)) {
-            max_sample = (max-min);
+    /* formats where each reader is independent are analyzed by a pool of workers */
+    GThreadPool *pool = NULL;
+    if (analysis.num_chunks > 1 && format_supports_parallel_read(sample->opened_audio_file)) {
+        pool = g_thread_pool_new(sample_max_min_chunk, NULL,
+                MIN(g_get_num_processors(), analysis.num_chunks), FALSE, NULL);
+    }
+
+    /* chunks are processed in order, so the published part grows from the start */
+    for (i = 0; i < analysis.num_chunks; i++) {
+        if (pool != NULL) {
+            g_thread_pool_push(pool, &analysis.chunks[i], NULL);
+        } else {
+            sample_max_min_chunk(&analysis.chunks[i], NULL);
         }
+    }
 
-        ret = read_sample(sample->opened_audio_file, devbuf, sample_info->blockSize, sample_info->blockSize * i);
+    if (pool != NULL) {
+        /* waits until all chunks have been processed */
+        g_thread_pool_free(pool, FALSE, TRUE);
+    }
 
-        g_mutex_lock(&sample->load_mutex);
-        sample->load_percentage = (double) i / numSampleBlocks;
-        g_mutex_unlock(&sample->load_mutex);
-        i++;
+    if (g_atomic_int_get(&sample->cancel_analysis)) {
+        g_free(analysis.chunks);
+        return;
     }
 
-    graphData->numSamples = numSampleBlocks;
+    min_sample = SHRT_MAX;
+    max_sample = 0;
 
-    if (graphData->data != NULL) {
-        free(graphData->data);
+    for (i = 0; i < analysis.num_chunks; i++) {
+        min_sample = MIN(min_sample, analysis.chunks[i].min_sample);
+        max_sample = MAX(max_sample, analysis.chunks[i].max_sample);
     }
-    graphData->data = graph_data;
 
+    g_free(analysis.chunks);
+
+    g_mutex_lock(&sample->load_mutex);
     graphData->minSampleAmp = min_sample;
     graphData->maxSampleAmp = max_sample;
-
-    if (sample_info->bitsPerSample == 8) {
-        graphData->maxSampleValue = UCHAR_MAX;
-    } else if (sample_info->bitsPerSample == 16) {
-        graphData->maxSampleValue = SHRT_MAX;
-    } else if (sample_info->bitsPerSample == 24) {
-	graphData->maxSampleValue = 0x7fffff;
-    }
+    g_mutex_unlock(&sample->load_mutex);
 
     g_mutex_lock(&sample->load_mutex);
-    sample->load_percentage = 1.0;
     sample->loaded = TRUE;
     g_mutex_unlock(&sample->load_mutex);
+
+    /* the graph data is not modified anymore, and sample_close() waits for this thread */
+    graph_data_save_cache(graphData, sample->opened_audio_file);
 }
 
 static void
@@ -505,6 +957,33 @@ trampoline_file_progress_changed(double progress, void *user_data)
     callbacks->on_file_progress_changed(progress, callbacks->user_data);
 }
 
+/**
+ * Expected new space needed for the output file for a range of decoded data, assuming a
+ * constant bitrate. If clone_block_size is non-zero, only the partial blocks at the start
+ * and the end are copied, the whole blocks in between are shared with the input file.
+ **/
+static uint64_t
+sample_estimate_output_size(Sample *sample, unsigned long start_pos, unsigned long end_pos, uint32_t clone_block_size)
+{
+    const OpenedAudioFile *file = sample->opened_audio_file;
+
+    if (end_pos == 0 || end_pos > file->sample_info.numBytes) {
+        end_pos = file->sample_info.numBytes;
+    }
+
+    if (end_pos <= start_pos || file->sample_info.numBytes == 0) {
+        return 0;
+    }
+
+    uint64_t size = (uint64_t)((double)(end_pos - start_pos) / file->sample_info.numBytes * file->file_size);
+
+    if (clone_block_size > 0 && size > 2 * (uint64_t)clone_block_size) {
+        size -= (size - 2 * (uint64_t)clone_block_size) / clone_block_size * clone_block_size;
+    }
+
+    return size;
+}
+
 static gpointer
 write_thread(gpointer data)
 {
@@ -525,24 +1004,57 @@ write_thread(gpointer data)
     char filename[1024];
 
     gulong num_files = 0;
+    uint64_t required_space = 0;
+    uint32_t clone_block_size = format_get_output_clone_block_size(sample->opened_audio_file, outputdir);
     enum OverwriteDecision overwrite_decision = OVERWRITE_DECISION_ASK;
 
     tbl_cur = tbl_head;
     while (tbl_cur != NULL) {
         tb_cur = tbl_cur->data;
+        tbl_next = g_list_next(tbl_cur);
 
         if (tb_cur->write == TRUE) {
             ++num_files;
+
+            start_pos = tb_cur->offset * sample->opened_audio_file->sample_info.blockSize;
+            end_pos = (tbl_next != NULL) ? ((TrackBreak *)tbl_next->data)->offset * sample->opened_audio_file->sample_info.blockSize : 0;
+            required_space += sample_estimate_output_size(sample, start_pos, end_pos, clone_block_size);
         }
 
-        tbl_cur = g_list_next(tbl_cur);
+        tbl_cur = tbl_next;
+    }
+
+    /* some files can be played, but not split */
+    char *error_message = NULL;
+    gboolean can_write = format_can_write_file(sample->opened_audio_file, &error_message);
+
+    if (!can_write) {
+        callbacks->on_error(error_message, callbacks->user_data);
+        g_free(error_message);
+    }
+
+    /* fail before the first byte is written, instead of in the middle of a track */
+    int64_t free_space = io_get_free_space(outputdir);
+    gboolean enough_space = (free_space < 0 || required_space <= (uint64_t)free_space);
+
+    if (can_write && !enough_space) {
+        gchar *required = g_format_size(required_space);
+        gchar *available = g_format_size(free_space);
+        gchar *message = g_strdup_printf(_("Not enough free space in %s (%s needed, %s available)"),
+                outputdir, required, available);
+
+        callbacks->on_error(message, callbacks->user_data);
+
+        g_free(message);
+        g_free(available);
+        g_free(required);
     }
 
     int i = 1;
     tbl_cur = tbl_head;
     tbl_next = g_list_next(tbl_cur);
 
-    while (tbl_cur != NULL && !callbacks->is_cancelled(callbacks->user_data)) {
+    while (can_write && enough_space && tbl_cur != NULL && !callbacks->is_cancelled(callbacks->user_data)) {
         tb_cur = tbl_cur->data;
 
         if (tb_cur->write) {
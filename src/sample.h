@@ -31,6 +31,9 @@ struct Points_ {
         int min, max;
 };
 
+/* Upper bound for GraphData.numLevels (one level per bit of numSamples) */
+#define GRAPH_DATA_MAX_LEVELS 64
+
 typedef struct GraphData_ GraphData;
 struct GraphData_{
 	unsigned long numSamples;
@@ -38,6 +41,16 @@ struct GraphData_{
         unsigned long maxSampleAmp;
         unsigned long minSampleAmp;
 	Points *data;
+
+        /**
+         * Min/max pyramid: levels[n] has one point for every 2^n blocks,
+         * levels[0] is the same as data and the last level has one point.
+         **/
+        int numLevels;
+        Points *levels[GRAPH_DATA_MAX_LEVELS];
+
+        /* if not NULL, the levels point into this (read-only) peak cache entry */
+        GMappedFile *cache_mapping;
 };
 
 enum OverwriteDecision {
@@ -128,9 +141,26 @@ sample_stop(Sample *sample);
 void
 sample_write_files(Sample *sample, TrackBreakList *list, WriteStatusCallbacks *callbacks, const char *output_dir);
 
+/**
+ * Available as soon as the length of the file is known, while the file is
+ * still being analyzed. Only the blocks before sample_get_analyzed_blocks()
+ * are final, and minSampleAmp/maxSampleAmp are only set once it is loaded.
+ **/
 GraphData *
 sample_get_graph_data(Sample *sample);
 
+/* Number of blocks at the start of the file for which the graph data is final */
+unsigned long
+sample_get_analyzed_blocks(Sample *sample);
+
+/* Number of points in a level of the pyramid */
+unsigned long
+graph_data_get_level_size(GraphData *graph_data, int level);
+
+/* Minimum and maximum of the blocks [start, end), in O(log(end - start)) */
+Points
+graph_data_get_range(GraphData *graph_data, unsigned long start, unsigned long end);
+
 unsigned long
 sample_get_num_sample_blocks(Sample *sample);
 
@@ -31,6 +31,7 @@ struct SampleInfo_ {
     unsigned int    avgBytesPerSec;
     unsigned short  blockAlign;
     unsigned short  bitsPerSample;
+    unsigned short  isFloat;
     unsigned long   numBytes;
     unsigned int    blockSize;
 };
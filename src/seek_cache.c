@@ -0,0 +1,220 @@
+/* wavbreaker - A tool to split a wave file up into multiple waves.
+ * Copyright (C) 2022 Thomas Perl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "seek_cache.h"
+
+#include "io_engine.h"
+
+#include <string.h>
+#include <sys/stat.h>
+
+#define SEEK_CACHE_MAGIC "WBSEEK1"
+
+/* Number of bytes at the start and at the end of the file that are hashed */
+#define SEEK_CACHE_HASH_SIZE (64 * 1024)
+
+typedef struct SeekCacheHeader_ SeekCacheHeader;
+struct SeekCacheHeader_ {
+    char magic[8];
+    uint64_t file_size;
+    int64_t mtime;
+    char hash[41];
+    char padding[7];
+    uint64_t data_size;
+};
+
+static char *
+seek_cache_get_filename(OpenedAudioFile *file, const char *kind)
+{
+    char *path = file->filename;
+    char *absolute = NULL;
+
+    if (!g_path_is_absolute(path)) {
+        char *cwd = g_get_current_dir();
+        path = absolute = g_build_filename(cwd, file->filename, NULL);
+        g_free(cwd);
+    }
+
+    char *key = g_compute_checksum_for_string(G_CHECKSUM_SHA1, path, -1);
+    char *basename = g_strdup_printf("%s.%s", key, kind);
+    char *result = g_build_filename(g_get_user_cache_dir(), "wavbreaker", "seek", basename, NULL);
+
+    g_free(basename);
+    g_free(key);
+    g_free(absolute);
+
+    return result;
+}
+
+static gboolean
+seek_cache_fill_header(OpenedAudioFile *file, SeekCacheHeader *header)
+{
+    struct stat st;
+
+    if (stat(file->filename, &st) != 0) {
+        return FALSE;
+    }
+
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, SEEK_CACHE_MAGIC, sizeof(header->magic));
+    header->file_size = file->file_size;
+    header->mtime = st.st_mtime;
+
+    /* catches files rewritten in place with the same size within the mtime granularity */
+    unsigned char *buf = g_malloc(SEEK_CACHE_HASH_SIZE);
+    GChecksum *checksum = g_checksum_new(G_CHECKSUM_SHA1);
+    gboolean ok = TRUE;
+
+    uint64_t tail_offset = (file->file_size > SEEK_CACHE_HASH_SIZE) ? (file->file_size - SEEK_CACHE_HASH_SIZE) : 0;
+    uint64_t offsets[] = { 0, tail_offset };
+
+    for (size_t i = 0; ok && i < G_N_ELEMENTS(offsets); ++i) {
+        gssize ret = io_pread(file->fp, buf, SEEK_CACHE_HASH_SIZE, offsets[i]);
+        if (ret < 0) {
+            ok = FALSE;
+        } else {
+            g_checksum_update(checksum, buf, ret);
+        }
+    }
+
+    if (ok) {
+        g_strlcpy(header->hash, g_checksum_get_string(checksum), sizeof(header->hash));
+    }
+
+    g_checksum_free(checksum);
+    g_free(buf);
+
+    return ok;
+}
+
+/* TRUE if contents is an entry for the file described by expected */
+static gboolean
+seek_cache_check_entry(const SeekCacheHeader *expected, const char *contents, size_t length)
+{
+    SeekCacheHeader header;
+
+    if (length < sizeof(header)) {
+        return FALSE;
+    }
+
+    memcpy(&header, contents, sizeof(header));
+
+    return memcmp(header.magic, expected->magic, sizeof(header.magic)) == 0 &&
+        header.file_size == expected->file_size &&
+        header.mtime == expected->mtime &&
+        memcmp(header.hash, expected->hash, sizeof(header.hash)) == 0 &&
+        header.data_size == length - sizeof(header);
+}
+
+void *
+seek_cache_load(OpenedAudioFile *file, const char *kind, size_t *size)
+{
+    SeekCacheHeader expected;
+    if (!seek_cache_fill_header(file, &expected)) {
+        return NULL;
+    }
+
+    char *filename = seek_cache_get_filename(file, kind);
+    gchar *contents = NULL;
+    gsize length = 0;
+    void *result = NULL;
+
+    if (g_file_get_contents(filename, &contents, &length, NULL)) {
+        if (seek_cache_check_entry(&expected, contents, length)) {
+            *size = length - sizeof(SeekCacheHeader);
+            memmove(contents, contents + sizeof(SeekCacheHeader), *size);
+            result = g_steal_pointer(&contents);
+        } else {
+            g_debug("Ignoring outdated seek cache %s", filename);
+        }
+
+        g_free(contents);
+    }
+
+    g_free(filename);
+
+    return result;
+}
+
+GMappedFile *
+seek_cache_map(OpenedAudioFile *file, const char *kind, const void **data, size_t *size)
+{
+    SeekCacheHeader expected;
+    if (!seek_cache_fill_header(file, &expected)) {
+        return NULL;
+    }
+
+    char *filename = seek_cache_get_filename(file, kind);
+    GMappedFile *result = g_mapped_file_new(filename, FALSE, NULL);
+
+    if (result != NULL) {
+        const char *contents = g_mapped_file_get_contents(result);
+        size_t length = g_mapped_file_get_length(result);
+
+        if (seek_cache_check_entry(&expected, contents, length)) {
+            *data = contents + sizeof(SeekCacheHeader);
+            *size = length - sizeof(SeekCacheHeader);
+        } else {
+            g_debug("Ignoring outdated seek cache %s", filename);
+            g_clear_pointer(&result, g_mapped_file_unref);
+        }
+    }
+
+    g_free(filename);
+
+    return result;
+}
+
+gboolean
+seek_cache_save(OpenedAudioFile *file, const char *kind, const void *data, size_t size)
+{
+    SeekCacheHeader header;
+    if (!seek_cache_fill_header(file, &header)) {
+        return FALSE;
+    }
+
+    header.data_size = size;
+
+    char *filename = seek_cache_get_filename(file, kind);
+    char *dirname = g_path_get_dirname(filename);
+    gboolean result = FALSE;
+
+    if (g_mkdir_with_parents(dirname, 0700) == 0) {
+        char *contents = g_malloc(sizeof(header) + size);
+        memcpy(contents, &header, sizeof(header));
+        memcpy(contents + sizeof(header), data, size);
+
+        GError *error = NULL;
+        /* written to a temporary file and renamed, so readers never see partial entries */
+        if (g_file_set_contents(filename, contents, sizeof(header) + size, &error)) {
+            result = TRUE;
+        } else {
+            g_warning("Could not write seek cache %s: %s", filename, error->message);
+            g_error_free(error);
+        }
+
+        g_free(contents);
+    } else {
+        g_warning("Could not create seek cache directory %s", dirname);
+    }
+
+    g_free(dirname);
+    g_free(filename);
+
+    return result;
+}
@@ -0,0 +1,43 @@
+/* wavbreaker - A tool to split a wave file up into multiple waves.
+ * Copyright (C) 2022 Thomas Perl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#pragma once
+
+#include "format.h"
+
+/**
+ * Persistent cache for data that is derived from a full pass over a file
+ * (e.g. seek indices or waveform peaks), stored in the user's cache directory. Entries
+ * are identified by the file name and a kind (one per type of data), and are
+ * only returned if the file still has the same size, modification time and
+ * hash of its first and last bytes as when the entry was saved.
+ **/
+
+/* Returns the cached data (free with g_free()) and sets *size, or NULL if not cached */
+void *
+seek_cache_load(OpenedAudioFile *file, const char *kind, size_t *size);
+
+/**
+ * Like seek_cache_load(), but maps the entry into memory instead of reading it.
+ * *data stays valid until the result is released with g_mapped_file_unref().
+ **/
+GMappedFile *
+seek_cache_map(OpenedAudioFile *file, const char *kind, const void **data, size_t *size);
+
+gboolean
+seek_cache_save(OpenedAudioFile *file, const char *kind, const void *data, size_t size);
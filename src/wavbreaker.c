@@ -74,6 +74,7 @@ static struct WaveformSurface *summary_surface;
 static GtkWidget *main_window;
 static GtkWidget *header_bar;
 static GtkWidget *header_bar_save_button;
+static GtkWidget *analysis_progress_bar;
 static GtkWidget *vpane1, *vpane2;
 static GtkWidget *scrollbar;
 static GtkAdjustment *adj;
@@ -107,6 +108,10 @@ static MoodbarData *moodbarData;
 static gulong cursor_marker;
 static int pixmap_offset;
 
+/* the sample view shows 2^zoom_level blocks per pixel */
+static int zoom_level;
+#define MAX_ZOOM_LEVEL 16
+
 // one-shot idle_add-style event sources
 static guint open_file_source_id;
 static guint redraw_source_id;
@@ -115,6 +120,10 @@ static guint redraw_source_id;
 static guint file_open_progress_source_id;
 static guint play_progress_source_id;
 
+// how much of the analysis of the current file has been shown
+static gboolean graph_data_shown;
+static unsigned long analyzed_blocks_shown;
+
 static struct FileWriteProgressUI *
 current_file_write_progress_ui = NULL;
 
@@ -163,6 +172,11 @@ static gboolean redraw_later( gpointer data);
 
 static void reset_sample_display(guint);
 
+static long visible_sample_blocks(int width);
+static float sample_view_x(gulong offset);
+static void update_scroll_range(int width);
+static void set_zoom_level(int level, gulong anchor);
+
 static gboolean
 configure_event(GtkWidget *widget,
                 GdkEventConfigure *event,
@@ -244,6 +258,12 @@ menu_jump_to(GtkWidget *widget, gpointer user_data);
 static void
 menu_prev_silence( GtkWidget* widget, gpointer user_data);
 
+static void
+menu_zoom_in(GSimpleAction *action, GVariant *parameter, gpointer user_data);
+
+static void
+menu_zoom_out(GSimpleAction *action, GVariant *parameter, gpointer user_data);
+
 void
 menu_add_track_break(GSimpleAction *action, GVariant *parameter, gpointer user_data);
 
@@ -1038,14 +1058,15 @@ gboolean
 file_play_progress_idle_func(gpointer data) {
     GtkAllocation allocation;
     gtk_widget_get_allocation(draw, &allocation);
-    gint half_width = allocation.width / 2;
-    gint offset = allocation.width * (1.0/PLAY_MARKER_SCROLL);
+    gint visible = visible_sample_blocks(allocation.width);
+    gint half_width = visible / 2;
+    gint offset = visible * (1.0/PLAY_MARKER_SCROLL);
 
     gulong play_marker = sample_get_play_marker(g_sample);
 
     gint x = play_marker - half_width;
     gint y = play_marker - pixmap_offset;
-    gint z = allocation.width * (1.0 - 1.0/PLAY_MARKER_SCROLL);
+    gint z = visible * (1.0 - 1.0/PLAY_MARKER_SCROLL);
 
     if (y > z && x > 0) {
         reset_sample_display(play_marker - offset + half_width);
@@ -1079,68 +1100,13 @@ file_open_progress_idle_func(gpointer data)
 {
     Sample *sample = data;
 
-    static GtkWidget *window;
-    static GtkWidget *pbar;
-    static GtkWidget *vbox;
-    static GtkWidget *label;
-    static char tmp_str[6144];
-    static char tmp_str2[6144];
-    static int current, size;
-
-    if (window == NULL) {
-        window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
-        gtk_widget_realize(window);
-        gtk_window_set_resizable(GTK_WINDOW(window), FALSE);
-        gtk_window_set_modal(GTK_WINDOW(window), TRUE);
-        gtk_window_set_transient_for(GTK_WINDOW(window),
-                GTK_WINDOW(main_window));
-        gtk_window_set_type_hint(GTK_WINDOW(window),
-                GDK_WINDOW_TYPE_HINT_DIALOG);
-        gtk_window_set_position(GTK_WINDOW(window),
-                GTK_WIN_POS_CENTER_ON_PARENT);
-        gdk_window_set_functions(GDK_WINDOW(gtk_widget_get_window(window)), GDK_FUNC_MOVE);
-
-        vbox = gtk_box_new(GTK_ORIENTATION_VERTICAL, 0);
-        gtk_container_add(GTK_CONTAINER(window), vbox);
-        gtk_container_set_border_width(GTK_CONTAINER(vbox), 10);
-
-        gtk_window_set_title( GTK_WINDOW(window), _("Analyzing waveform"));
-
-        tmp_str[0] = '\0';
-        strcat( tmp_str, "<span size=\"larger\" weight=\"bold\">");
-        strcat( tmp_str, gtk_window_get_title( GTK_WINDOW( window)));
-        strcat( tmp_str, "</span>");
-
-        label = gtk_label_new( NULL);
-        gtk_label_set_markup( GTK_LABEL(label), tmp_str);
-        g_object_set(G_OBJECT(label), "xalign", 0.0f, "yalign", 0.5f, NULL);
-        gtk_box_pack_start(GTK_BOX(vbox), label, FALSE, TRUE, 5);
-
-        label = gtk_label_new( _("The waveform data of the selected file is being analyzed and processed. This can take some time."));
-        gtk_label_set_line_wrap( GTK_LABEL(label), TRUE);
-        g_object_set(G_OBJECT(label), "xalign", 0.0f, "yalign", 0.5f, NULL);
-        gtk_box_pack_start(GTK_BOX(vbox), label, FALSE, TRUE, 5);
+    char tmp_str[1024];
+    int current, size;
 
-        pbar = gtk_progress_bar_new();
-        gtk_box_pack_start(GTK_BOX(vbox), pbar, FALSE, TRUE, 5);
+    GraphData *graph_data = sample_get_graph_data(sample);
 
-        sprintf( tmp_str, _("Analyzing %s"), sample_get_basename(sample));
-        gchar *str = g_markup_escape_text(tmp_str, -1);
-        sprintf( tmp_str2, "<i>%s</i>", str);
-        g_free(str);
-
-        label = gtk_label_new( NULL);
-        gtk_label_set_markup( GTK_LABEL(label), tmp_str2);
-        g_object_set(G_OBJECT(label), "xalign", 0.0f, "yalign", 0.5f, NULL);
-        gtk_label_set_ellipsize( GTK_LABEL(label), PANGO_ELLIPSIZE_END);
-        gtk_box_pack_start(GTK_BOX(vbox), label, FALSE, TRUE, 5);
-
-        gtk_widget_show_all(GTK_WIDGET(window));
-    }
-
-    if (sample_is_loaded(sample)) {
-        gtk_widget_destroy(window);
-        window = NULL;
+    if (graph_data != NULL && !graph_data_shown) {
+        graph_data_shown = TRUE;
 
         /* --------------------------------------------------- */
         /* Reset things because we have a new file             */
@@ -1171,26 +1137,40 @@ file_open_progress_idle_func(gpointer data)
         }
         track_break_list_set_total_duration(track_breaks, sample_get_num_sample_blocks(sample));
 
-        // Now that the file is fully loaded, update the duration
+        // Now that the length of the file is known, update the duration
         track_break_update_gui_model();
         redraw();
 
         /* --------------------------------------------------- */
+    }
+
+    if (graph_data != NULL && sample_get_analyzed_blocks(sample) != analyzed_blocks_shown) {
+        /* show the part of the waveform that has been analyzed so far */
+        analyzed_blocks_shown = sample_get_analyzed_blocks(sample);
+        redraw();
+    }
+
+    if (sample_is_loaded(sample)) {
+        gtk_widget_hide(analysis_progress_bar);
+
+        /* silence detection needs the amplitude range of the whole file */
+        gtk_widget_set_sensitive(button_seek_backward, TRUE);
+        gtk_widget_set_sensitive(button_seek_forward, TRUE);
 
         file_open_progress_source_id = 0;
         return FALSE;
+    }
 
-    } else {
-        double load_percentage = sample_get_load_percentage(sample);
+    double load_percentage = sample_get_load_percentage(sample);
 
-        size = sample_get_file_size(sample) / (1024*1024);
-        current = size*load_percentage;
-        sprintf( tmp_str, _("%d of %d MB analyzed"), current, size);
-        gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(pbar), load_percentage);
-        gtk_progress_bar_set_text( GTK_PROGRESS_BAR(pbar), tmp_str);
+    size = sample_get_file_size(sample) / (1024*1024);
+    current = size*load_percentage;
+    sprintf( tmp_str, _("%d of %d MB analyzed"), current, size);
+    gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(analysis_progress_bar), load_percentage);
+    gtk_progress_bar_set_text( GTK_PROGRESS_BAR(analysis_progress_bar), tmp_str);
+    gtk_widget_show(analysis_progress_bar);
 
-        return TRUE;
-    }
+    return TRUE;
 }
 
 static void open_file(const char *filename) {
@@ -1231,16 +1211,20 @@ static void open_file(const char *filename) {
     gtk_widget_set_sensitive( cursor_marker_sec_spinner, TRUE);
     gtk_widget_set_sensitive( cursor_marker_subsec_spinner, TRUE);
 
-    gtk_widget_set_sensitive(button_seek_backward, TRUE);
+    gtk_widget_set_sensitive(button_seek_backward, FALSE);
     gtk_widget_set_sensitive(button_jump_to_time, TRUE);
-    gtk_widget_set_sensitive(button_seek_forward, TRUE);
+    gtk_widget_set_sensitive(button_seek_forward, FALSE);
     gtk_widget_set_sensitive(button_auto_split, TRUE);
     gtk_widget_set_sensitive(button_add_break, TRUE);
     gtk_widget_set_sensitive(button_remove_break, TRUE);
 
+    set_action_enabled("zoom_in", TRUE);
+    set_action_enabled("zoom_out", TRUE);
+
     menu_stop(NULL, NULL);
 
     cursor_marker = 0;
+    zoom_level = 0;
     gtk_list_store_clear(store);
 
     if (track_breaks != NULL) {
@@ -1252,6 +1236,8 @@ static void open_file(const char *filename) {
     if (file_open_progress_source_id) {
         g_source_remove(file_open_progress_source_id);
     }
+    graph_data_shown = FALSE;
+    analyzed_blocks_shown = 0;
     file_open_progress_source_id = g_timeout_add(100, file_open_progress_idle_func, g_sample);
     set_title(sample_get_basename(g_sample));
 }
@@ -1387,8 +1373,10 @@ static gboolean redraw_later( gpointer data)
     struct WaveformSurfaceDrawContext ctx = {
         .widget = draw,
         .pixmap_offset = pixmap_offset,
+        .zoom_level = zoom_level,
         .list = track_breaks,
         .graphData = sample_get_graph_data(g_sample),
+        .analyzed_blocks = sample_get_analyzed_blocks(g_sample),
         .moodbarData = appconfig_get_show_moodbar() ? moodbarData : NULL,
     };
     waveform_surface_draw(sample_surface, &ctx);
@@ -1404,16 +1392,10 @@ static gboolean redraw_later( gpointer data)
     return FALSE;
 }
 
-static gboolean configure_event(GtkWidget *widget,
-    GdkEventConfigure *event, gpointer data)
+/* Scrollbar range and page size for the current zoom level */
+static void update_scroll_range(int width)
 {
-    if (g_sample == NULL) {
-        return FALSE;
-    }
-
-    GtkAllocation allocation;
-    gtk_widget_get_allocation(widget, &allocation);
-    int width = allocation.width;
+    width = visible_sample_blocks(width);
 
     if (sample_get_num_sample_blocks(g_sample) == 0) {
         pixmap_offset = 0;
@@ -1434,15 +1416,30 @@ static gboolean configure_event(GtkWidget *widget,
         gtk_adjustment_set_page_increment(adj, width / 2);
     }
 
-    gtk_adjustment_set_step_increment(adj, 10);
+    gtk_adjustment_set_step_increment(adj, 10 << zoom_level);
     gtk_adjustment_set_value(adj, pixmap_offset);
     gtk_adjustment_set_upper(cursor_marker_spinner_adj, sample_get_num_sample_blocks(g_sample) - 1);
+}
+
+static gboolean configure_event(GtkWidget *widget,
+    GdkEventConfigure *event, gpointer data)
+{
+    if (g_sample == NULL) {
+        return FALSE;
+    }
+
+    GtkAllocation allocation;
+    gtk_widget_get_allocation(widget, &allocation);
+
+    update_scroll_range(allocation.width);
 
     struct WaveformSurfaceDrawContext ctx = {
         .widget = widget,
         .pixmap_offset = pixmap_offset,
+        .zoom_level = zoom_level,
         .list = track_breaks,
         .graphData = sample_get_graph_data(g_sample),
+        .analyzed_blocks = sample_get_analyzed_blocks(g_sample),
         .moodbarData = appconfig_get_show_moodbar() ? moodbarData : NULL,
     };
     waveform_surface_draw(sample_surface, &ctx);
@@ -1475,11 +1472,11 @@ static gboolean draw_draw_event(GtkWidget *widget, cairo_t *cr, gpointer data)
     blit_cairo_surface(cr, sample_surface->surface, width, height);
 
     cairo_set_line_width( cr, 1);
-    if( cursor_marker >= pixmap_offset && cursor_marker <= pixmap_offset + width) {
+    if( cursor_marker >= pixmap_offset && cursor_marker <= pixmap_offset + visible_sample_blocks(width)) {
         /**
          * Draw RED cursor marker
          **/
-        float x = cursor_marker - pixmap_offset + 0.5f;
+        float x = sample_view_x(cursor_marker) + 0.5f;
 
         cairo_set_source_rgba(cr, 1.f, 0.f, 0.f, 0.9f);
         cairo_move_to(cr, x, 0.f);
@@ -1503,7 +1500,7 @@ static gboolean draw_draw_event(GtkWidget *widget, cairo_t *cr, gpointer data)
         /**
          * Draw GREEN play marker
          **/
-        float x = sample_get_play_marker(g_sample) - pixmap_offset + 0.5f;
+        float x = sample_view_x(sample_get_play_marker(g_sample)) + 0.5f;
 
         cairo_set_source_rgba(cr, 0.f, 0.7f, 0.f, 0.9f);
         cairo_move_to(cr, x, 0.f);
@@ -1568,8 +1565,8 @@ static gboolean draw_draw_event(GtkWidget *widget, cairo_t *cr, gpointer data)
         if( !(tbs[i]->write)) {
             continue;
         }
-        border_left = (tbs[i]->offset > pixmap_offset)?(tbs[i]->offset - pixmap_offset):(0);
-        border_right = (i+1 == tbc)?(width+100):(tbs[i+1]->offset - pixmap_offset);
+        border_left = (tbs[i]->offset > pixmap_offset)?(sample_view_x(tbs[i]->offset)):(0);
+        border_right = (i+1 == tbc)?(width+100):(sample_view_x(tbs[i+1]->offset));
 
         gchar *filename = track_break_get_filename(tbs[i], track_breaks);
         strcpy(tmp, filename);
@@ -1618,8 +1615,10 @@ draw_summary_configure_event(GtkWidget *widget,
     struct WaveformSurfaceDrawContext ctx = {
         .widget = widget,
         .pixmap_offset = pixmap_offset,
+        .zoom_level = zoom_level,
         .list = track_breaks,
         .graphData = sample_get_graph_data(g_sample),
+        .analyzed_blocks = sample_get_analyzed_blocks(g_sample),
         .moodbarData = appconfig_get_show_moodbar() ? moodbarData : NULL,
     };
     waveform_surface_draw(summary_surface, &ctx);
@@ -1640,6 +1639,7 @@ draw_summary_draw_event(GtkWidget *widget, cairo_t *cr, gpointer user_data)
           height = allocation.height;
 
     gfloat summary_scale;
+    gint visible = visible_sample_blocks(width);
 
     summary_scale = (float)(sample_get_num_sample_blocks(g_sample)) / (float)(width);
 
@@ -1652,15 +1652,15 @@ draw_summary_draw_event(GtkWidget *widget, cairo_t *cr, gpointer user_data)
     cairo_set_source_rgba( cr, 0, 0, 0, 0.3);
     cairo_rectangle( cr, 0, 0, pixmap_offset / summary_scale, height);
     cairo_fill( cr);
-    cairo_rectangle( cr, (pixmap_offset+width) / summary_scale, 0, width - (pixmap_offset+width) / summary_scale, height);
+    cairo_rectangle( cr, (pixmap_offset+visible) / summary_scale, 0, width - (pixmap_offset+visible) / summary_scale, height);
     cairo_fill( cr);
 
     cairo_set_source_rgba( cr, 1, 1, 1, 0.6);
     cairo_set_line_width( cr, 1);
     cairo_move_to( cr, (int)(pixmap_offset / summary_scale) + 0.5, 0);
     cairo_line_to( cr, (int)(pixmap_offset / summary_scale) + 0.5, height);
-    cairo_move_to( cr, (int)((pixmap_offset+width) / summary_scale) + 0.5, 0);
-    cairo_line_to( cr, (int)((pixmap_offset+width) / summary_scale) + 0.5, height);
+    cairo_move_to( cr, (int)((pixmap_offset+visible) / summary_scale) + 0.5, 0);
+    cairo_line_to( cr, (int)((pixmap_offset+visible) / summary_scale) + 0.5, height);
     cairo_stroke( cr);
 
     return FALSE;
@@ -1709,11 +1709,80 @@ static gboolean draw_summary_button_release(GtkWidget *widget,
     return TRUE;
 }
 
+/* Number of blocks shown in a sample view of the given width */
+static long visible_sample_blocks(int width)
+{
+    return (long)width << zoom_level;
+}
+
+/* Horizontal position of a block offset in the sample view */
+static float sample_view_x(gulong offset)
+{
+    return (float)((long)offset - pixmap_offset) / (1 << zoom_level);
+}
+
+static void set_zoom_level(int level, gulong anchor)
+{
+    GtkAllocation allocation;
+    gtk_widget_get_allocation(draw, &allocation);
+
+    if (!g_sample || allocation.width <= 0) {
+        return;
+    }
+
+    /* zooming out further than the whole file does not show anything new */
+    int max_level = 0;
+    while (max_level < MAX_ZOOM_LEVEL &&
+           ((long)allocation.width << max_level) < sample_get_num_sample_blocks(g_sample)) {
+        max_level++;
+    }
+
+    level = CLAMP(level, 0, max_level);
+    if (level == zoom_level) {
+        return;
+    }
+
+    /* keep the anchor block at the same horizontal position */
+    long x = ((long)anchor - pixmap_offset) >> zoom_level;
+    zoom_level = level;
+    pixmap_offset = MAX(0, (long)anchor - (x << zoom_level));
+
+    update_scroll_range(allocation.width);
+    gtk_widget_queue_draw(scrollbar);
+
+    redraw();
+}
+
+static gulong zoom_anchor()
+{
+    GtkAllocation allocation;
+    gtk_widget_get_allocation(draw, &allocation);
+
+    /* zoom around the cursor marker if it is visible, otherwise around the center */
+    if (cursor_marker >= pixmap_offset && cursor_marker <= pixmap_offset + visible_sample_blocks(allocation.width)) {
+        return cursor_marker;
+    }
+
+    return pixmap_offset + visible_sample_blocks(allocation.width) / 2;
+}
+
+static void
+menu_zoom_in(GSimpleAction *action, GVariant *parameter, gpointer user_data)
+{
+    set_zoom_level(zoom_level - 1, zoom_anchor());
+}
+
+static void
+menu_zoom_out(GSimpleAction *action, GVariant *parameter, gpointer user_data)
+{
+    set_zoom_level(zoom_level + 1, zoom_anchor());
+}
+
 void reset_sample_display(guint midpoint)
 {
     GtkAllocation allocation;
     gtk_widget_get_allocation(draw, &allocation);
-    int width = allocation.width;
+    int width = visible_sample_blocks(allocation.width);
     int start = midpoint - width / 2;
 
     if (!g_sample) {
@@ -1800,6 +1869,19 @@ static gboolean scroll_event( GtkWidget *widget, GdkEventScroll *event, gpointer
 {
     long step, upper, size;
 
+    if (widget == draw && (event->state & GDK_CONTROL_MASK)) {
+        /* keep the block under the mouse pointer in place */
+        gulong anchor = pixmap_offset + ((long)event->x << zoom_level);
+
+        if (event->direction == GDK_SCROLL_UP) {
+            set_zoom_level(zoom_level - 1, anchor);
+        } else if (event->direction == GDK_SCROLL_DOWN) {
+            set_zoom_level(zoom_level + 1, anchor);
+        }
+
+        return TRUE;
+    }
+
     step = gtk_adjustment_get_page_increment(adj);
     upper = gtk_adjustment_get_upper(adj);
     size = gtk_adjustment_get_page_size(adj);
@@ -1842,7 +1924,7 @@ static gboolean button_release(GtkWidget *widget, GdkEventButton *event,
         return TRUE;
     }
 
-    if (event->x + pixmap_offset > sample_get_num_sample_blocks(g_sample)) {
+    if (pixmap_offset + ((long)event->x << zoom_level) > sample_get_num_sample_blocks(g_sample)) {
         return TRUE;
     }
 
@@ -1852,7 +1934,7 @@ static gboolean button_release(GtkWidget *widget, GdkEventButton *event,
 
     int w = gtk_widget_get_allocated_width(widget);
 
-    int center = pixmap_offset + w/2;
+    int center = pixmap_offset + visible_sample_blocks(w)/2;
 
     static const int MINIMUM_SCROLL_STEP = 10;
     static const int MAXIMUM_SCROLL_STEP = 50;
@@ -1866,7 +1948,7 @@ static gboolean button_release(GtkWidget *widget, GdkEventButton *event,
             offset = -MAXIMUM_SCROLL_STEP;
         }
 
-        reset_sample_display(center + offset);
+        reset_sample_display(center + offset * (1 << zoom_level));
 
         cursor_marker = pixmap_offset;
     } else if (event->x > w-1) {
@@ -1878,11 +1960,11 @@ static gboolean button_release(GtkWidget *widget, GdkEventButton *event,
             offset = MAXIMUM_SCROLL_STEP;
         }
 
-        reset_sample_display(center + offset);
+        reset_sample_display(center + offset * (1 << zoom_level));
 
-        cursor_marker = pixmap_offset + w-1;
+        cursor_marker = pixmap_offset + ((w-1) << zoom_level);
     } else {
-        cursor_marker = pixmap_offset + event->x;
+        cursor_marker = pixmap_offset + ((long)event->x << zoom_level);
     }
 
     if (event->type == GDK_BUTTON_RELEASE && event->button == 3) {
@@ -1924,8 +2006,9 @@ static gboolean button_release(GtkWidget *widget, GdkEventButton *event,
         }
     }
 
+    /* snapping distance is in pixels, so it scales with the zoom level */
     static const long SNAP_DISTANCE_FRAMES = 20;
-    if (nearest_track_break && ABS((long)cursor_marker - (long)nearest_track_break->offset) < SNAP_DISTANCE_FRAMES) {
+    if (nearest_track_break && ABS((long)cursor_marker - (long)nearest_track_break->offset) < (SNAP_DISTANCE_FRAMES << zoom_level)) {
         // snap cursor to track break
         cursor_marker = nearest_track_break->offset;
         containing_track_break_index = nearest_track_break_index;
@@ -2570,6 +2653,9 @@ do_activate(GApplication *app, gpointer user_data)
         { "auto_rename", menu_rename, NULL, NULL, NULL, },
         { "remove_break", menu_delete_track_break, NULL, NULL, NULL, },
         { "jump_break", jump_to_track_break, NULL, NULL, NULL, },
+
+        { "zoom_in", menu_zoom_in, NULL, NULL, NULL, },
+        { "zoom_out", menu_zoom_out, NULL, NULL, NULL, },
     };
 
     g_action_map_add_action_entries(G_ACTION_MAP(main_window),
@@ -2590,6 +2676,9 @@ do_activate(GApplication *app, gpointer user_data)
     set_action_enabled("export", FALSE);
     set_action_enabled("import", FALSE);
 
+    set_action_enabled("zoom_in", FALSE);
+    set_action_enabled("zoom_out", FALSE);
+
 #if defined(WANT_MOODBAR)
     set_action_enabled("display_moodbar", FALSE);
     set_action_enabled("generate_moodbar", FALSE);
@@ -2646,6 +2735,14 @@ do_activate(GApplication *app, gpointer user_data)
     gtk_widget_set_tooltip_text(header_bar_save_button, _("Save file parts"));
     gtk_header_bar_pack_start(GTK_HEADER_BAR(header_bar), header_bar_save_button);
 
+    /* the waveform can be used while it is being analyzed, so progress is shown in the header bar */
+    analysis_progress_bar = gtk_progress_bar_new();
+    gtk_progress_bar_set_show_text(GTK_PROGRESS_BAR(analysis_progress_bar), TRUE);
+    gtk_widget_set_valign(analysis_progress_bar, GTK_ALIGN_CENTER);
+    gtk_widget_set_tooltip_text(analysis_progress_bar, _("Analyzing waveform"));
+    gtk_widget_set_no_show_all(analysis_progress_bar, TRUE);
+    gtk_header_bar_pack_end(GTK_HEADER_BAR(header_bar), analysis_progress_bar);
+
     gtk_window_set_titlebar(GTK_WINDOW(main_window), header_bar);
 
     set_title( NULL);
@@ -2788,6 +2885,21 @@ do_activate(GApplication *app, gpointer user_data)
              G_CALLBACK(menu_next_silence), NULL);
     button_seek_forward = button;
 
+    // Zoom
+    bbox = gtk_button_box_new(GTK_ORIENTATION_HORIZONTAL);
+    gtk_box_pack_start(GTK_BOX(hbox), bbox, FALSE, FALSE, 0);
+    gtk_button_box_set_layout(GTK_BUTTON_BOX(bbox), GTK_BUTTONBOX_EXPAND);
+
+    button = gtk_button_new_from_icon_name("zoom-out-symbolic", GTK_ICON_SIZE_SMALL_TOOLBAR);
+    gtk_widget_set_tooltip_text(button, _("Zoom out"));
+    gtk_actionable_set_action_name(GTK_ACTIONABLE(button), "win.zoom_out");
+    gtk_box_pack_start(GTK_BOX(bbox), button, FALSE, FALSE, 0);
+
+    button = gtk_button_new_from_icon_name("zoom-in-symbolic", GTK_ICON_SIZE_SMALL_TOOLBAR);
+    gtk_widget_set_tooltip_text(button, _("Zoom in"));
+    gtk_actionable_set_action_name(GTK_ACTIONABLE(button), "win.zoom_in");
+    gtk_box_pack_start(GTK_BOX(bbox), button, FALSE, FALSE, 0);
+
     // Spacer
     gtk_box_pack_start(GTK_BOX(hbox), gtk_label_new(""), TRUE, TRUE, 0);
 